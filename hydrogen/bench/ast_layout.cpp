@@ -0,0 +1,381 @@
+// Memory and traversal speed of the flat AST (ast.hpp) against the pointer
+// AST it replaced.
+//
+// Usage: ast_layout [size in MB, default 20]
+//
+// The corpus is parsed into the flat AST, which is then copied into the old
+// pointer layout: one arena object per node, a std::variant of pointers at
+// every level, and 32-byte Tokens in identifier and literal nodes, allocated
+// in the order the old parser made them. The old parser also gave each pair
+// of parentheses a node, which the copy cannot, so the pointer side comes
+// out slightly smaller than it was. Both trees are then walked the same way,
+// recursively, as the old generator did.
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "parser.hpp"
+#include "./bench.hpp"
+
+// The pointer layout, copied from the parser as it was before the flat AST.
+struct NodeTermIntLit {
+    Token int_lit;
+};
+
+struct NodeTermIdent {
+    Token ident;
+};
+
+struct NodeExpr;
+struct NodeTermParen {
+    NodeExpr* expr;
+};
+
+struct NodeBinExprAdd {
+    NodeExpr* lft_hnd_side;
+    NodeExpr* rght_hnd_side;
+};
+
+struct NodeBinExprSub {
+    NodeExpr* lft_hnd_side;
+    NodeExpr* rght_hnd_side;
+};
+
+struct NodeBinExprDiv {
+    NodeExpr* lft_hnd_side;
+    NodeExpr* rght_hnd_side;
+};
+
+struct NodeBinExprMulti {
+    NodeExpr* lft_hnd_side;
+    NodeExpr* rght_hnd_side;
+};
+
+struct NodeBinExpr {
+    std::variant<NodeBinExprAdd*, NodeBinExprSub*, NodeBinExprMulti*, NodeBinExprDiv*> var;
+};
+
+struct NodeTerm {
+    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*> var;
+};
+
+struct NodeExpr {
+    std::variant<NodeTerm*, NodeBinExpr*> var;
+};
+
+struct NodeStmtExit {
+    NodeExpr* expr;
+};
+
+struct NodeStmtLet {
+    Token ident;
+    NodeExpr* expr {};
+};
+
+struct NodeStmt;
+struct NodeScope {
+    ArenaSpan<NodeStmt*> stmts;
+};
+
+struct NodeIfPred;
+struct NodeIfPredElif {
+    NodeExpr* expr {};
+    NodeScope* scope {};
+    std::optional<NodeIfPred*> pred;
+};
+
+struct NodeIfPredElse {
+    NodeScope* scope;
+};
+
+struct NodeIfPred {
+    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
+};
+
+struct NodeStmtIf {
+    NodeExpr* expr {};
+    NodeScope* scope {};
+    std::optional<NodeIfPred*> pred;
+};
+
+struct NodeStmtAssign {
+    Token ident;
+    NodeExpr* expr {};
+};
+
+struct NodeStmt {
+    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*> var;
+};
+
+struct NodeProg {
+    ArenaSpan<NodeStmt*> stmts;
+};
+
+// Copies a flat AST into the pointer layout, children first, as the old
+// parser allocated them.
+class PointerAstBuilder {
+public:
+    PointerAstBuilder(const Ast& ast, const SymbolTable& names, ArenaAllocator& allocator)
+        : m_ast(ast)
+        , m_names(names)
+        , m_allocator(allocator)
+        , m_built(ast.kinds.size) {
+    }
+
+    NodeProg* build() {
+        for (NodeIndex idx = 0; idx < m_ast.kinds.size; idx++) {
+            m_built[idx] = build_node(idx);
+        }
+        return static_cast<NodeProg*>(m_built[m_ast.root()]);
+    }
+
+private:
+    void* build_node(const NodeIndex idx) {
+        const AstNode& node = m_ast.node(idx);
+        switch (m_ast.kind(idx)) {
+            case NodeKind::int_lit: {
+                const auto term = m_allocator.emplace<NodeTermIntLit>(Token { TokenType::int_lit, {} });
+                return expr(m_allocator.emplace<NodeTerm>(term));
+            }
+            case NodeKind::ident: {
+                const auto term = m_allocator.emplace<NodeTermIdent>(ident(node.a));
+                return expr(m_allocator.emplace<NodeTerm>(term));
+            }
+            case NodeKind::add:
+                return bin_expr(m_allocator.emplace<NodeBinExprAdd>(child<NodeExpr>(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::sub:
+                return bin_expr(m_allocator.emplace<NodeBinExprSub>(child<NodeExpr>(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::multi:
+                return bin_expr(m_allocator.emplace<NodeBinExprMulti>(child<NodeExpr>(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::div:
+                return bin_expr(m_allocator.emplace<NodeBinExprDiv>(child<NodeExpr>(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::stmt_exit:
+                return stmt(m_allocator.emplace<NodeStmtExit>(child<NodeExpr>(node.a)));
+            case NodeKind::stmt_let:
+                return stmt(m_allocator.emplace<NodeStmtLet>(ident(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::stmt_assign:
+                return stmt(m_allocator.emplace<NodeStmtAssign>(ident(node.a), child<NodeExpr>(node.b)));
+            case NodeKind::scope:
+                // Stays a bare NodeScope, since if/elif/else refer to it
+                // directly; wrapped in a NodeStmt where a list holds it.
+                return m_allocator.emplace<NodeScope>(stmt_list(idx));
+            case NodeKind::stmt_if:
+                return stmt(m_allocator.emplace<NodeStmtIf>(child<NodeExpr>(node.a), child<NodeScope>(node.b), pred(node.c)));
+            case NodeKind::pred_elif: {
+                const auto elif = m_allocator.emplace<NodeIfPredElif>(child<NodeExpr>(node.a), child<NodeScope>(node.b), pred(node.c));
+                return m_allocator.emplace<NodeIfPred>(elif);
+            }
+            case NodeKind::pred_else:
+                return m_allocator.emplace<NodeIfPred>(m_allocator.emplace<NodeIfPredElse>(child<NodeScope>(node.a)));
+            case NodeKind::prog:
+                return m_allocator.emplace<NodeProg>(stmt_list(idx));
+        }
+        return nullptr;
+    }
+
+    template <typename T>
+    [[nodiscard]] T* child(const NodeIndex idx) const {
+        return static_cast<T*>(m_built[idx]);
+    }
+
+    [[nodiscard]] std::optional<NodeIfPred*> pred(const NodeIndex idx) const {
+        if (idx == k_no_node) {
+            return {};
+        }
+        return child<NodeIfPred>(idx);
+    }
+
+    [[nodiscard]] Token ident(const SymbolId symbol) const {
+        return { TokenType::ident, m_names.name(symbol), symbol };
+    }
+
+    NodeExpr* expr(NodeTerm* term) {
+        return m_allocator.emplace<NodeExpr>(term);
+    }
+
+    template <typename BinExpr>
+    NodeExpr* bin_expr(BinExpr* bin) {
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeBinExpr>(bin));
+    }
+
+    template <typename Stmt>
+    NodeStmt* stmt(Stmt* inner) {
+        return m_allocator.emplace<NodeStmt>(inner);
+    }
+
+    ArenaSpan<NodeStmt*> stmt_list(const NodeIndex idx) {
+        const ArenaSpan<NodeIndex> stmts = m_ast.stmts(idx);
+        const auto list = static_cast<NodeStmt**>(m_allocator.alloc_bytes(stmts.size * sizeof(NodeStmt*), alignof(NodeStmt*)));
+        for (size_t pos = 0; pos < stmts.size; pos++) {
+            const NodeIndex stmt_idx = stmts[pos];
+            list[pos] = m_ast.kind(stmt_idx) == NodeKind::scope ? stmt(child<NodeScope>(stmt_idx)) : child<NodeStmt>(stmt_idx);
+        }
+        return { list, stmts.size };
+    }
+
+    const Ast& m_ast;
+    const SymbolTable& m_names;
+    ArenaAllocator& m_allocator;
+    std::vector<void*> m_built;
+};
+
+// Both walks visit every node once and fold its kind (and symbol, for
+// identifiers and variables) into a checksum, so they can be compared.
+std::uint64_t mix(const std::uint64_t sum, const NodeKind kind, const std::uint64_t symbol = 0) {
+    return sum * 31 + static_cast<std::uint64_t>(kind) * 7 + symbol;
+}
+
+std::uint64_t walk_flat(const Ast& ast, const NodeIndex idx, std::uint64_t sum) {
+    const NodeKind kind = ast.kind(idx);
+    const AstNode& node = ast.node(idx);
+    switch (kind) {
+        case NodeKind::int_lit:
+            return mix(sum, kind);
+        case NodeKind::ident:
+            return mix(sum, kind, node.a);
+        case NodeKind::stmt_let:
+        case NodeKind::stmt_assign:
+            return walk_flat(ast, node.b, mix(sum, kind, node.a));
+        case NodeKind::scope:
+        case NodeKind::prog:
+            sum = mix(sum, kind);
+            for (const NodeIndex stmt : ast.stmts(idx)) {
+                sum = walk_flat(ast, stmt, sum);
+            }
+            return sum;
+        case NodeKind::stmt_exit:
+        case NodeKind::pred_else:
+            return walk_flat(ast, node.a, mix(sum, kind));
+        case NodeKind::stmt_if:
+        case NodeKind::pred_elif:
+            sum = walk_flat(ast, node.b, walk_flat(ast, node.a, mix(sum, kind)));
+            return node.c == k_no_node ? sum : walk_flat(ast, node.c, sum);
+        default:
+            return walk_flat(ast, node.b, walk_flat(ast, node.a, mix(sum, kind)));
+    }
+}
+
+std::uint64_t walk_pointer(const NodeScope* scope, std::uint64_t sum);
+
+std::uint64_t walk_pointer(const NodeExpr* expr, std::uint64_t sum) {
+    if (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+        if (std::holds_alternative<NodeTermIntLit*>((*term)->var)) {
+            return mix(sum, NodeKind::int_lit);
+        }
+        if (const auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+            return mix(sum, NodeKind::ident, (*ident)->ident.symbol);
+        }
+        return walk_pointer(std::get<NodeTermParen*>((*term)->var)->expr, sum);
+    }
+    const NodeBinExpr* bin = std::get<NodeBinExpr*>(expr->var);
+    return std::visit(
+        [&](const auto* op) {
+            using Op = std::remove_cvref_t<decltype(*op)>;
+            NodeKind kind = NodeKind::div;
+            if constexpr (std::is_same_v<Op, NodeBinExprAdd>) {
+                kind = NodeKind::add;
+            }
+            else if constexpr (std::is_same_v<Op, NodeBinExprSub>) {
+                kind = NodeKind::sub;
+            }
+            else if constexpr (std::is_same_v<Op, NodeBinExprMulti>) {
+                kind = NodeKind::multi;
+            }
+            return walk_pointer(op->rght_hnd_side, walk_pointer(op->lft_hnd_side, mix(sum, kind)));
+        },
+        bin->var);
+}
+
+std::uint64_t walk_pointer(const NodeIfPred* pred, std::uint64_t sum) {
+    if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+        sum = walk_pointer((*elif)->scope, walk_pointer((*elif)->expr, mix(sum, NodeKind::pred_elif)));
+        return (*elif)->pred.has_value() ? walk_pointer((*elif)->pred.value(), sum) : sum;
+    }
+    return walk_pointer(std::get<NodeIfPredElse*>(pred->var)->scope, mix(sum, NodeKind::pred_else));
+}
+
+std::uint64_t walk_pointer(const NodeStmt* stmt, std::uint64_t sum) {
+    switch (stmt->var.index()) {
+        case 0:
+            return walk_pointer(std::get<NodeStmtExit*>(stmt->var)->expr, mix(sum, NodeKind::stmt_exit));
+        case 1: {
+            const NodeStmtLet* let = std::get<NodeStmtLet*>(stmt->var);
+            return walk_pointer(let->expr, mix(sum, NodeKind::stmt_let, let->ident.symbol));
+        }
+        case 2:
+            return walk_pointer(std::get<NodeScope*>(stmt->var), sum);
+        case 3: {
+            const NodeStmtIf* stmt_if = std::get<NodeStmtIf*>(stmt->var);
+            sum = walk_pointer(stmt_if->scope, walk_pointer(stmt_if->expr, mix(sum, NodeKind::stmt_if)));
+            return stmt_if->pred.has_value() ? walk_pointer(stmt_if->pred.value(), sum) : sum;
+        }
+        default: {
+            const NodeStmtAssign* assign = std::get<NodeStmtAssign*>(stmt->var);
+            return walk_pointer(assign->expr, mix(sum, NodeKind::stmt_assign, assign->ident.symbol));
+        }
+    }
+}
+
+std::uint64_t walk_pointer(const NodeScope* scope, std::uint64_t sum) {
+    sum = mix(sum, NodeKind::scope);
+    for (const NodeStmt* stmt : scope->stmts) {
+        sum = walk_pointer(stmt, sum);
+    }
+    return sum;
+}
+
+std::uint64_t walk_pointer(const NodeProg* prog) {
+    std::uint64_t sum = mix(0, NodeKind::prog);
+    for (const NodeStmt* stmt : prog->stmts) {
+        sum = walk_pointer(stmt, sum);
+    }
+    return sum;
+}
+
+double mebibytes(const size_t bytes) {
+    return static_cast<double>(bytes) / (1024 * 1024);
+}
+
+int main(const int argc, const char* argv[]) {
+    const std::string src = generate_corpus(size_arg(argc, argv, 1, 20));
+    SymbolTable symbols;
+    Parser parser(Tokenizer(src, symbols).tokenize());
+    const std::optional<Ast> flat = parser.parse_prog();
+    if (!flat.has_value()) {
+        std::cerr << "Corpus did not parse" << std::endl;
+        return EXIT_FAILURE;
+    }
+    ArenaAllocator pointer_arena(1024 * 1024);
+    const NodeProg* pointer = PointerAstBuilder(flat.value(), symbols, pointer_arena).build();
+
+    const size_t flat_bytes = flat->kinds.size * sizeof(NodeKind) + flat->nodes.size * sizeof(AstNode)
+        + flat->lists.size * sizeof(NodeIndex);
+    std::uint64_t flat_sum = 0;
+    std::uint64_t pointer_sum = 0;
+    const double flat_walk = best_time(5, [&] {
+        flat_sum = walk_flat(flat.value(), flat->root(), 0);
+    });
+    const double pointer_walk = best_time(5, [&] {
+        pointer_sum = walk_pointer(pointer);
+    });
+    if (flat_sum != pointer_sum) {
+        std::cerr << "The two walks disagree" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << std::fixed << std::setprecision(1) << mebibytes(src.size()) << " MB, " << flat->kinds.size
+              << " nodes, walks best of 5\n"
+              << "layout      memory       walk\n"
+              << "pointer " << std::setw(7) << mebibytes(pointer_arena.bytes_used()) << " MiB" << std::setw(8)
+              << pointer_walk * 1e3 << " ms\n"
+              << "flat    " << std::setw(7) << mebibytes(flat_bytes) << " MiB" << std::setw(8) << flat_walk * 1e3
+              << " ms\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "tokenization.hpp"
+
+// Shared by the benchmarks in this directory: a generator for synthetic
+// programs, timing, and comparing token buffers.
+
+// A syntactically valid program of at least `size` bytes. The mix is roughly
+// that of hand-written code: declarations with long identifiers, assignments,
+// nested if/else blocks, and line and block comments.
+inline std::string generate_corpus(const size_t size, const unsigned seed = 1) {
+    std::mt19937 rng(seed);
+    const auto below = [&](const size_t bound) {
+        return std::uniform_int_distribution<size_t>(0, bound - 1)(rng);
+    };
+    std::string src;
+    src.reserve(size + 4096);
+    size_t depth = 0;
+    size_t vars = 0;
+    while (src.size() < size) {
+        const std::string indent(depth * 4, ' ');
+        const size_t roll = below(100);
+        if (roll < 10) {
+            src += indent + "// " + std::string(10 + below(60), '-') + "\n";
+        }
+        else if (roll < 13) {
+            src += indent + "/* ";
+            for (size_t lines = 1 + below(3); lines > 0; lines--) {
+                src += std::string(40, '*') + "\n";
+            }
+            src += indent + " */\n";
+        }
+        else if (roll < 50) {
+            const size_t lhs = vars == 0 ? 0 : below(vars);
+            const size_t rhs = vars == 0 ? 0 : below(vars);
+            src += indent + "let v" + std::string(below(9), 'x') + "LongIdentifierName" + std::to_string(vars) + " = (v"
+                + std::to_string(lhs) + " + " + std::to_string(below(10000)) + ") * 3 - v" + std::to_string(rhs)
+                + " / 2;\n";
+            vars++;
+        }
+        else if (roll < 80) {
+            src += indent + "abc" + std::to_string(below(100)) + " = abc" + std::to_string(below(100)) + " + 42;\n";
+        }
+        else if (roll < 90 && depth < 6) {
+            src += indent + "if (x) {\n";
+            depth++;
+        }
+        else if (depth > 0) {
+            depth--;
+            src += std::string(depth * 4, ' ') + "} else {\n" + std::string(depth * 4, ' ') + "}\n";
+        }
+        else {
+            src += indent + "exit(0);\n";
+        }
+    }
+    while (depth > 0) {
+        depth--;
+        src += std::string(depth * 4, ' ') + "}\n";
+    }
+    return src;
+}
+
+// Size argument in megabytes (fractions allowed), or `fallback` if it is
+// missing.
+inline size_t size_arg(const int argc, const char* argv[], const int idx, const double fallback) {
+    return static_cast<size_t>((idx < argc ? std::strtod(argv[idx], nullptr) : fallback) * 1024 * 1024);
+}
+
+// Best wall time of `runs` calls of `fn`, in seconds.
+template <typename Fn>
+double best_time(const size_t runs, Fn fn) {
+    double best = 1e300;
+    for (size_t run = 0; run < runs; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        best = std::min(best, time.count());
+    }
+    return best;
+}
+
+// Whether two token buffers over the same source hold the same tokens, symbol
+// ids included.
+inline bool same_tokens(const TokenBuffer& lhs, const TokenBuffer& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t idx = 0; idx < lhs.size(); idx++) {
+        const Token l = lhs.at(idx);
+        const Token r = rhs.at(idx);
+        if (l.type != r.type || l.value.data() != r.value.data() || l.value.size() != r.value.size()
+            || l.symbol != r.symbol) {
+            return false;
+        }
+    }
+    return true;
+}
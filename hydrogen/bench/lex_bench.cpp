@@ -0,0 +1,174 @@
+// Tokenizer throughput: the table-driven DFA in tokenization.hpp against the
+// if/else lexer it replaced, on a synthetic program.
+//
+// Usage: lex_bench [size in MB, default 100]
+
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "tokenization.hpp"
+#include "./bench.hpp"
+
+// The lexer as it was before the DFA: one branch per token kind, with
+// std::isalpha and friends. Kept here only as the baseline. It fills the
+// same TokenBuffer and interns identifiers the same way the DFA does, so the
+// two produce the same output and only the lexing itself differs.
+class IfElseTokenizer {
+public:
+    IfElseTokenizer(const std::string_view src, SymbolTable& symbols) : m_src(src), m_symbols(&symbols) {
+    }
+
+    TokenBuffer tokenize() {
+        TokenBuffer tokens(m_src);
+        while (peek().has_value()) {
+            if (std::isalpha(peek().value())) {
+                const size_t begin = m_curr_idx;
+                consume();
+                while (peek().has_value() && std::isalnum(peek().value())) {
+                    consume();
+                }
+                const std::string_view buf = m_src.substr(begin, m_curr_idx - begin);
+                if (buf == "exit") {
+                    tokens.push_back({ TokenType::exit, buf });
+                }
+                else if (buf == "let") {
+                    tokens.push_back({ TokenType::let, buf });
+                }
+                else if (buf == "if") {
+                    tokens.push_back({ TokenType::if_, buf });
+                }
+                else if (buf == "elif") {
+                    tokens.push_back({ TokenType::elif, buf });
+                }
+                else if (buf == "else") {
+                    tokens.push_back({ TokenType::else_, buf });
+                }
+                else {
+                    tokens.push_back({ TokenType::ident, buf, m_symbols->intern(buf) });
+                }
+            }
+            else if (std::isdigit(peek().value())) {
+                const size_t begin = m_curr_idx;
+                consume();
+                while (peek().has_value() && std::isdigit(peek().value())) {
+                    consume();
+                }
+                tokens.push_back({ TokenType::int_lit, m_src.substr(begin, m_curr_idx - begin) });
+            }
+            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
+                consume();
+                consume();
+                while (peek().has_value() && peek().value() != '\n') {
+                    consume();
+                }
+            }
+            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
+                consume();
+                consume();
+                while (peek().has_value()) {
+                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
+                        break;
+                    }
+                    consume();
+                }
+                if (peek().has_value()) {
+                    consume();
+                }
+                if (peek().has_value()) {
+                    consume();
+                }
+            }
+            else if (peek().value() == '(') {
+                push_single(tokens, TokenType::open_paren);
+            }
+            else if (peek().value() == ')') {
+                push_single(tokens, TokenType::close_paren);
+            }
+            else if (peek().value() == ';') {
+                push_single(tokens, TokenType::semi);
+            }
+            else if (peek().value() == '=') {
+                push_single(tokens, TokenType::eq);
+            }
+            else if (peek().value() == '+') {
+                push_single(tokens, TokenType::plus);
+            }
+            else if (peek().value() == '*') {
+                push_single(tokens, TokenType::star);
+            }
+            else if (peek().value() == '-') {
+                push_single(tokens, TokenType::minus);
+            }
+            else if (peek().value() == '/') {
+                push_single(tokens, TokenType::fslash);
+            }
+            else if (peek().value() == '{') {
+                push_single(tokens, TokenType::open_curly);
+            }
+            else if (peek().value() == '}') {
+                push_single(tokens, TokenType::close_curly);
+            }
+            else if (std::isspace(peek().value())) {
+                consume();
+            }
+            else {
+                error_invalid_token();
+            }
+        }
+        m_curr_idx = 0;
+        return tokens;
+    }
+
+private:
+    [[nodiscard]] std::optional<char> peek(const size_t offset = 0) const {
+        if (m_curr_idx + offset >= m_src.length()) {
+            return {};
+        }
+        return m_src[m_curr_idx + offset];
+    }
+
+    char consume() {
+        return m_src[m_curr_idx++];
+    }
+
+    void push_single(TokenBuffer& tokens, const TokenType type) {
+        tokens.push_back({ type, m_src.substr(m_curr_idx, 1) });
+        consume();
+    }
+
+    const std::string_view m_src;
+    SymbolTable* m_symbols;
+    size_t m_curr_idx = 0;
+};
+
+int main(const int argc, const char* argv[]) {
+    const std::string src = generate_corpus(size_arg(argc, argv, 1, 100));
+    const double megabytes = static_cast<double>(src.size()) / (1024 * 1024);
+
+    SymbolTable dfa_symbols;
+    SymbolTable if_else_symbols;
+    if (!same_tokens(Tokenizer(src, dfa_symbols).tokenize(), IfElseTokenizer(src, if_else_symbols).tokenize())) {
+        std::cerr << "The two tokenizers disagree" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    size_t token_count = 0;
+    const double dfa = best_time(3, [&] {
+        SymbolTable symbols;
+        token_count = Tokenizer(src, symbols).tokenize().size();
+    });
+    const double if_else = best_time(3, [&] {
+        SymbolTable symbols;
+        IfElseTokenizer(src, symbols).tokenize();
+    });
+
+    std::cout << std::fixed << std::setprecision(1) << megabytes << " MB, " << token_count << " tokens, best of 3\n"
+              << "if/else  " << std::setw(8) << megabytes / if_else << " MB/s\n"
+              << "dfa      " << std::setw(8) << megabytes / dfa << " MB/s\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+// Scaling of tokenize_parallel() with the thread count, and where splitting
+// a source starts to pay off (k_parallel_tokenize_min_size).
+//
+// Usage: lex_scaling [size in MB, default 100] [max threads, default 16]
+//
+// The first table tokenizes the whole corpus with 1, 2, 4, ... threads. The
+// second compares one thread against the max thread count on prefixes of
+// growing size, with the size threshold turned off.
+
+#include <iostream>
+#include <cstdlib>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "pipeline.hpp"
+#include "./bench.hpp"
+
+double tokenize_time(const std::string_view src, const size_t threads) {
+    return best_time(3, [&] {
+        SymbolTable symbols;
+        tokenize_parallel(src, symbols, threads, 0);
+    });
+}
+
+int main(const int argc, const char* argv[]) {
+    const std::string src = generate_corpus(size_arg(argc, argv, 1, 100));
+    const size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    const double megabytes = static_cast<double>(src.size()) / (1024 * 1024);
+    std::cout << std::fixed << std::setprecision(1) << megabytes << " MB, " << std::thread::hardware_concurrency()
+              << " hardware threads, best of 3\n\n";
+
+    SymbolTable sequential_symbols;
+    const TokenBuffer sequential = Tokenizer(src, sequential_symbols).tokenize();
+    std::cout << "threads      MB/s  speedup\n";
+    double base = 0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        SymbolTable symbols;
+        if (!same_tokens(tokenize_parallel(src, symbols, threads, 0), sequential)) {
+            std::cerr << threads << " threads give different tokens" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const double time = tokenize_time(src, threads);
+        base = threads == 1 ? time : base;
+        std::cout << std::setw(7) << threads << std::setw(10) << megabytes / time << std::setw(8) << base / time
+                  << "x\n";
+    }
+
+    std::cout << "\n     size  1 thread  " << std::setw(2) << max_threads << " threads\n";
+    for (size_t size = 256 * 1024; size <= src.size(); size *= 2) {
+        // Cut at a line break so no token is split.
+        const std::string_view prefix = std::string_view(src).substr(0, src.rfind('\n', size) + 1);
+        std::cout << std::setprecision(2) << std::setw(6) << static_cast<double>(size) / (1024 * 1024) << " MB"
+                  << std::setprecision(1) << std::setw(7) << tokenize_time(prefix, 1) * 1e3 << " ms" << std::setw(8) << tokenize_time(prefix, max_threads) * 1e3
+                  << " ms\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+// Heap allocations per parsed statement, counted by replacing the global
+// operator new, for the batch (TokenBuffer) and streaming (TokenStream)
+// front ends. Only allocations made inside parse_prog() are counted, so
+// tokenizing the whole buffer up front is left out.
+//
+// Usage: parse_allocs [size in MB, default 16]
+//
+// The harness only uses the Tokenizer, TokenStream and Parser entry points,
+// which have not changed since identifiers were interned, so the same file
+// builds against the tree from before the parser got its token cursor:
+//
+//   git worktree add /tmp/before "$(git log -1 --format=%h --grep='^\[user-010\]')"
+//   g++ -std=c++20 -O2 -I/tmp/before/hydrogen/src bench/parse_allocs.cpp -o parse_allocs_before
+//   ./parse_allocs_before 0.5
+//
+// Parsers of that age allocate nodes from a fixed 4 MB arena, so keep the
+// corpus at about 0.5 MB for them.
+
+#include <iostream>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "parser.hpp"
+#include "./bench.hpp"
+
+static bool g_counting = false;
+static size_t g_allocations = 0;
+static size_t g_allocated_bytes = 0;
+
+void* operator new(const size_t size) {
+    if (g_counting) {
+        g_allocations++;
+        g_allocated_bytes += size;
+    }
+    if (void* const ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* const ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Statements in `tokens`: every `;` ends one, and every `if` and every `{`
+// that does not follow an if/elif condition or an `else` starts one.
+size_t count_stmts(const TokenBuffer& tokens) {
+    size_t count = 0;
+    for (size_t idx = 0; idx < tokens.size(); idx++) {
+        switch (tokens.type(idx)) {
+            case TokenType::semi:
+            case TokenType::if_:
+                count++;
+                break;
+            case TokenType::open_curly:
+                if (idx == 0 || (tokens.type(idx - 1) != TokenType::close_paren && tokens.type(idx - 1) != TokenType::else_)) {
+                    count++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return count;
+}
+
+template <typename AnyParser>
+void report(const char* front_end, AnyParser& parser, const size_t stmts) {
+    g_allocations = 0;
+    g_allocated_bytes = 0;
+    g_counting = true;
+    const auto prog = parser.parse_prog();
+    g_counting = false;
+    if (!prog.has_value()) {
+        std::cerr << "Corpus did not parse" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << std::left << std::setw(8) << front_end << std::right << std::setw(12) << g_allocations
+              << std::setw(14) << g_allocated_bytes << std::fixed << std::setprecision(4) << std::setw(12)
+              << static_cast<double>(g_allocations) / static_cast<double>(stmts) << "\n";
+}
+
+int main(const int argc, const char* argv[]) {
+    const std::string src = generate_corpus(size_arg(argc, argv, 1, 16));
+    SymbolTable symbols;
+    TokenBuffer tokens = Tokenizer(src, symbols).tokenize();
+    const size_t stmts = count_stmts(tokens);
+    std::cout << src.size() << " bytes, " << tokens.size() << " tokens, " << stmts << " statements\n"
+              << "front end    allocs         bytes  per stmt\n";
+    {
+        Parser parser(std::move(tokens));
+        report("batch", parser, stmts);
+    }
+    {
+        SymbolTable stream_symbols;
+        Parser parser(TokenStream(src, Tokenizer(src, stream_symbols)));
+        report("stream", parser, stmts);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+// Throughput of ParallelParser against the thread count, and where splitting
+// a program starts to pay off (k_parallel_parse_min_tokens).
+//
+// Usage: parse_scaling [size in MB, default 20] [max threads, default 16]
+//
+// The first table parses the whole corpus sequentially and then with 1, 2,
+// 4, ... threads, and checks that every result equals the sequential parse
+// array for array. The second compares the sequential parser against the
+// max thread count on prefixes of growing size. Tokenizing, and copying the
+// tokens each parser takes, are not timed.
+
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "parallel_parse.hpp"
+#include "./bench.hpp"
+
+template <typename T>
+bool same_span(const ArenaSpan<T> lhs, const ArenaSpan<T> rhs) {
+    return lhs.size == rhs.size && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+}
+
+bool same_ast(const Ast& lhs, const Ast& rhs) {
+    return same_span(lhs.kinds, rhs.kinds) && same_span(lhs.lists, rhs.lists)
+        && std::equal(lhs.nodes.begin(), lhs.nodes.end(), rhs.nodes.begin(), rhs.nodes.end(),
+            [](const AstNode& l, const AstNode& r) {
+                return l.a == r.a && l.b == r.b && l.c == r.c;
+            });
+}
+
+// Best time of 3 parses of `tokens`, with `threads` threads or, for 0,
+// with the sequential Parser.
+double parse_time(const TokenBuffer& tokens, const size_t threads) {
+    double best = 1e300;
+    for (size_t run = 0; run < 3; run++) {
+        TokenBuffer copy = tokens;
+        const auto start = std::chrono::steady_clock::now();
+        if (threads == 0) {
+            Parser parser(std::move(copy));
+            parser.parse_prog();
+        }
+        else {
+            ParallelParser parser(std::move(copy), threads);
+            parser.parse_prog();
+        }
+        const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        best = std::min(best, time.count());
+    }
+    return best;
+}
+
+int main(const int argc, const char* argv[]) {
+    const std::string src = generate_corpus(size_arg(argc, argv, 1, 20));
+    const size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    SymbolTable symbols;
+    const TokenBuffer tokens = Tokenizer(src, symbols).tokenize();
+    const double megatokens = static_cast<double>(tokens.size()) / 1e6;
+    std::cout << std::fixed << std::setprecision(1) << static_cast<double>(src.size()) / (1024 * 1024) << " MB, "
+              << megatokens << "M tokens, " << std::thread::hardware_concurrency()
+              << " hardware threads, best of 3\n\n";
+
+    Parser sequential(TokenBuffer { tokens });
+    const std::optional<Ast> expected = sequential.parse_prog();
+    if (!expected.has_value()) {
+        std::cerr << "Corpus did not parse" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double base = parse_time(tokens, 0);
+    std::cout << "threads  Mtokens/s  speedup\n"
+              << "    seq" << std::setw(11) << megatokens / base << "     1.0x\n";
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        ParallelParser parser(TokenBuffer { tokens }, threads);
+        const std::optional<Ast> ast = parser.parse_prog();
+        if (!ast.has_value() || !same_ast(ast.value(), expected.value())) {
+            std::cerr << threads << " threads give a different AST" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const double time = parse_time(tokens, threads);
+        std::cout << std::setw(7) << threads << std::setw(11) << megatokens / time << std::setw(8) << base / time
+                  << "x\n";
+    }
+
+    std::cout << "\n   tokens       seq  " << std::setw(2) << max_threads << " threads\n";
+    for (size_t size = 256 * 1024; size <= src.size(); size *= 2) {
+        // Cut before a line that starts a top-level statement or comment,
+        // so the prefix parses.
+        size_t cut = src.rfind('\n', size);
+        while (cut + 1 < src.size() && std::isalpha(static_cast<unsigned char>(src[cut + 1])) == 0 && src[cut + 1] != '/') {
+            cut = src.rfind('\n', cut - 1);
+        }
+        const std::string_view prefix = std::string_view(src).substr(0, cut + 1);
+        SymbolTable prefix_symbols;
+        const TokenBuffer prefix_tokens = Tokenizer(prefix, prefix_symbols).tokenize();
+        std::cout << std::setw(9) << prefix_tokens.size() << std::setw(7) << parse_time(prefix_tokens, 0) * 1e3
+                  << " ms" << std::setw(8) << parse_time(prefix_tokens, max_threads) * 1e3 << " ms\n";
+    }
+    return EXIT_SUCCESS;
+}
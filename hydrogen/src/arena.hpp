@@ -1,62 +1,328 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 
+#include <sys/mman.h>
+
+struct ArenaStats {
+    // Bytes handed out since the last reset(), alignment padding included.
+    std::size_t bytes_used;
+    // Bytes mapped from the OS, chunk headers included.
+    std::size_t bytes_reserved;
+    std::size_t chunk_count;
+    // Largest bytes_used seen over the arena's lifetime.
+    std::size_t high_water_mark;
+};
+
+// Bump allocator over a list of mmap'd chunks. When the current chunk is full
+// the next one is mapped at twice the size (or larger, for a big request), so
+// the number of chunks stays logarithmic in the total size. reset() rewinds
+// to the first chunk and keeps every mapping, so a reused arena does not go
+// back to the OS until it needs more than it had before.
 class ArenaAllocator final {
 public:
-    explicit ArenaAllocator(const std::size_t max_num_bytes) 
-        : m_size { max_num_bytes }
-        , m_buffer { new std::byte[max_num_bytes] }
-        , m_offset { m_buffer } {
+    // With `huge_pages`, chunks are rounded up to 2 MB and marked for
+    // transparent huge pages.
+    explicit ArenaAllocator(const std::size_t initial_chunk_size, const bool huge_pages = false)
+        : m_next_chunk_size { initial_chunk_size }
+        , m_huge_pages { huge_pages } {
     }
 
     ArenaAllocator(const ArenaAllocator&) = delete;
     ArenaAllocator& operator=(const ArenaAllocator&) = delete;
 
-    ArenaAllocator(ArenaAllocator&& other) noexcept 
-        : m_size { std::exchange(other.m_size, 0) }
-        , m_buffer { std::exchange(other.m_buffer, nullptr) }
-        , m_offset { std::exchange(other.m_offset, nullptr) } {
+    ArenaAllocator(ArenaAllocator&& other) noexcept
+        : m_first { std::exchange(other.m_first, nullptr) }
+        , m_current { std::exchange(other.m_current, nullptr) }
+        , m_offset { std::exchange(other.m_offset, nullptr) }
+        , m_end { std::exchange(other.m_end, nullptr) }
+        , m_retired_bytes { std::exchange(other.m_retired_bytes, 0) }
+        , m_reserved_bytes { std::exchange(other.m_reserved_bytes, 0) }
+        , m_chunk_count { std::exchange(other.m_chunk_count, 0) }
+        , m_high_water_mark { std::exchange(other.m_high_water_mark, 0) }
+        , m_next_chunk_size { other.m_next_chunk_size }
+        , m_huge_pages { other.m_huge_pages } {
     }
 
     ArenaAllocator& operator=(ArenaAllocator&& other) noexcept {
-        std::swap(m_size, other.m_size);
-        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_first, other.m_first);
+        std::swap(m_current, other.m_current);
         std::swap(m_offset, other.m_offset);
+        std::swap(m_end, other.m_end);
+        std::swap(m_retired_bytes, other.m_retired_bytes);
+        std::swap(m_reserved_bytes, other.m_reserved_bytes);
+        std::swap(m_chunk_count, other.m_chunk_count);
+        std::swap(m_high_water_mark, other.m_high_water_mark);
+        std::swap(m_next_chunk_size, other.m_next_chunk_size);
+        std::swap(m_huge_pages, other.m_huge_pages);
         return *this;
     }
 
+    [[nodiscard]] void* alloc_bytes(const std::size_t size, const std::size_t align) {
+        std::byte* aligned = align_up(m_offset, align);
+        if (m_offset == nullptr || size > static_cast<std::size_t>(m_end - aligned)) {
+            next_chunk(size + align);
+            aligned = align_up(m_offset, align);
+        }
+        m_offset = aligned + size;
+        return aligned;
+    }
+
     template <typename T>
     [[nodiscard]] T* alloc() {
-        std::size_t remaining_num_bytes = m_size - static_cast<std::size_t>(m_offset - m_buffer);
-        auto pointer = static_cast<void*>(m_offset);
-        const auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
-        if (aligned_address == nullptr) {
-            throw std::bad_alloc {};
-        }
-        m_offset = static_cast<std::byte*>(aligned_address) + sizeof(T);
-        return static_cast<T*>(aligned_address);
+        return static_cast<T*>(alloc_bytes(sizeof(T), alignof(T)));
     }
 
     template <typename T, typename... Args>
     [[nodiscard]] T* emplace(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
         const auto allocated_memory = alloc<T>();
         return new (allocated_memory) T { std::forward<Args>(args)... };
     }
 
+    // Discards everything allocated so far (without running destructors) and
+    // starts over in the first chunk.
+    void reset() {
+        m_high_water_mark = std::max(m_high_water_mark, bytes_used());
+        m_retired_bytes = 0;
+        m_current = m_first;
+        if (m_current != nullptr) {
+            m_offset = m_current->data();
+            m_end = m_current->end();
+        }
+    }
+
+    [[nodiscard]] std::size_t bytes_used() const {
+        return m_current == nullptr ? 0 : m_retired_bytes + static_cast<std::size_t>(m_offset - m_current->data());
+    }
+
+    [[nodiscard]] ArenaStats stats() const {
+        return { bytes_used(), m_reserved_bytes, m_chunk_count, std::max(m_high_water_mark, bytes_used()) };
+    }
+
     ~ArenaAllocator() {
-        // No destructors are called for the stored objects. Thus, memory
-        // leaks are possible (e.g. when storing std::vector objects or
-        // other non-trivially destructable objects in the allocator).
-        // Although this could be changed, it would come with additional
-        // runtime overhead and therefore is not implemented.
-        delete[] m_buffer;
+        // No destructors are called for the stored objects, so emplace()
+        // only accepts trivially destructible types. Containers of nodes
+        // use ArenaVector/ArenaSpan, which keep their elements in the arena
+        // as well, so releasing the chunks releases everything.
+        Chunk* chunk = m_first;
+        while (chunk != nullptr) {
+            Chunk* const next = chunk->next;
+            munmap(chunk, chunk->size);
+            chunk = next;
+        }
+    }
+
+private:
+    static constexpr std::size_t k_page_size = 4096;
+    static constexpr std::size_t k_huge_page_size = 2 * 1024 * 1024;
+
+    // Sits at the start of its own mapping.
+    struct Chunk {
+        Chunk* next;
+        std::size_t size;
+
+        std::byte* data() {
+            return reinterpret_cast<std::byte*>(this + 1);
+        }
+
+        std::byte* end() {
+            return reinterpret_cast<std::byte*>(this) + size;
+        }
+    };
+
+    static std::byte* align_up(std::byte* pointer, const std::size_t align) {
+        const auto address = reinterpret_cast<std::uintptr_t>(pointer);
+        return pointer + ((align - address % align) % align);
+    }
+
+    // Moves on to the first following chunk with at least `min_bytes` of
+    // room, mapping a new one if there is none.
+    void next_chunk(const std::size_t min_bytes) {
+        if (m_current != nullptr) {
+            m_retired_bytes += static_cast<std::size_t>(m_offset - m_current->data());
+            // Chunks left over from before a reset() are reused in order.
+            Chunk* chunk = m_current->next;
+            while (chunk != nullptr && static_cast<std::size_t>(chunk->end() - chunk->data()) < min_bytes) {
+                chunk = chunk->next;
+            }
+            if (chunk != nullptr) {
+                use_chunk(chunk);
+                return;
+            }
+            while (m_current->next != nullptr) {
+                m_current = m_current->next;
+            }
+        }
+        const std::size_t granularity = m_huge_pages ? k_huge_page_size : k_page_size;
+        std::size_t size = std::max(m_next_chunk_size, min_bytes + sizeof(Chunk));
+        size = (size + granularity - 1) / granularity * granularity;
+        void* const map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            throw std::bad_alloc {};
+        }
+#ifdef MADV_HUGEPAGE
+        if (m_huge_pages) {
+            madvise(map, size, MADV_HUGEPAGE);
+        }
+#endif
+        const auto chunk = new (map) Chunk { nullptr, size };
+        if (m_current == nullptr) {
+            m_first = chunk;
+        }
+        else {
+            m_current->next = chunk;
+        }
+        m_reserved_bytes += size;
+        m_chunk_count++;
+        m_next_chunk_size = size * 2;
+        use_chunk(chunk);
+    }
+
+    void use_chunk(Chunk* const chunk) {
+        m_current = chunk;
+        m_offset = chunk->data();
+        m_end = chunk->end();
+    }
+
+    Chunk* m_first = nullptr;
+    Chunk* m_current = nullptr;
+    std::byte* m_offset = nullptr;
+    std::byte* m_end = nullptr;
+    std::size_t m_retired_bytes = 0;
+    std::size_t m_reserved_bytes = 0;
+    std::size_t m_chunk_count = 0;
+    std::size_t m_high_water_mark = 0;
+    std::size_t m_next_chunk_size;
+    bool m_huge_pages;
+};
+
+// Fixed view of `size` elements stored in an arena. Trivially destructible,
+// so nodes can hold one.
+template <typename T>
+struct ArenaSpan {
+    T* data = nullptr;
+    std::size_t size = 0;
+
+    [[nodiscard]] T* begin() const {
+        return data;
+    }
+
+    [[nodiscard]] T* end() const {
+        return data + size;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size == 0;
+    }
+
+    T& operator[](const std::size_t idx) const {
+        return data[idx];
+    }
+};
+
+// Small vector for building up an ArenaSpan. The first `InlineCount` elements
+// live inside the object itself (on the caller's stack, typically), and
+// beyond that the storage moves to the arena and doubles as needed. Storage
+// given up while growing is not reused until the arena is reset.
+template <typename T, std::size_t InlineCount = 8>
+class ArenaVector {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+public:
+    explicit ArenaVector(ArenaAllocator& arena) : m_arena(&arena) {
+    }
+
+    ArenaVector(const ArenaVector&) = delete;
+    ArenaVector& operator=(const ArenaVector&) = delete;
+
+    void push_back(const T& value) {
+        if (m_size == m_capacity) {
+            grow(m_capacity * 2);
+        }
+        data()[m_size++] = value;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return m_size;
+    }
+
+    // Makes room for `capacity` elements without reallocating.
+    void reserve(const std::size_t capacity) {
+        if (capacity > m_capacity) {
+            grow(capacity);
+        }
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_size == 0;
     }
+
+    T& operator[](const std::size_t idx) {
+        return data()[idx];
+    }
+
+    T& back() {
+        return data()[m_size - 1];
+    }
+
+    void pop_back() {
+        m_size--;
+    }
+
+    // Drops the elements from `size` on; keeps the capacity.
+    void truncate(const std::size_t size) {
+        m_size = std::min(m_size, size);
+    }
+
+    // Returns the elements as arena storage; the vector must not be used
+    // afterwards.
+    [[nodiscard]] ArenaSpan<T> finish() {
+        if (m_heap != nullptr || m_size == 0) {
+            return { m_heap, m_size };
+        }
+        const auto storage = static_cast<T*>(m_arena->alloc_bytes(sizeof(T) * m_size, alignof(T)));
+        std::memcpy(storage, m_inline, sizeof(T) * m_size);
+        return { storage, m_size };
+    }
+
+    // Same, with the storage in `arena`: in place if the vector grew there,
+    // an exactly sized copy otherwise.
+    [[nodiscard]] ArenaSpan<T> finish(ArenaAllocator& arena) {
+        if (&arena == m_arena) {
+            return finish();
+        }
+        if (m_size == 0) {
+            return { nullptr, 0 };
+        }
+        const auto storage = static_cast<T*>(arena.alloc_bytes(sizeof(T) * m_size, alignof(T)));
+        std::memcpy(storage, data(), sizeof(T) * m_size);
+        return { storage, m_size };
+    }
+
 private:
-    std::size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    T* data() {
+        return m_heap != nullptr ? m_heap : m_inline;
+    }
+
+    void grow(const std::size_t capacity) {
+        const auto storage = static_cast<T*>(m_arena->alloc_bytes(sizeof(T) * capacity, alignof(T)));
+        std::memcpy(storage, data(), sizeof(T) * m_size);
+        m_heap = storage;
+        m_capacity = capacity;
+    }
+
+    ArenaAllocator* m_arena;
+    T* m_heap = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = InlineCount;
+    T m_inline[InlineCount];
 };
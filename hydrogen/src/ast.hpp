@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+
+#include "./arena.hpp"
+
+using NodeIndex = std::uint32_t;
+
+inline constexpr NodeIndex k_no_node = UINT32_MAX;
+
+// One byte per node. The comments give the meaning of the node's a/b/c
+// fields.
+enum class NodeKind : std::uint8_t {
+    // a, b: low and high 32 bits of the value.
+    int_lit,
+    // a: symbol, c: its variable's slot once resolved (see Resolver).
+    ident,
+    // a: left-hand side, b: right-hand side. Parentheses leave no node of
+    // their own.
+    add,
+    sub,
+    multi,
+    div,
+    // a: expression.
+    stmt_exit,
+    // a: symbol, b: expression.
+    stmt_let,
+    // Same, and c: the variable's slot once resolved.
+    stmt_assign,
+    // a: first statement in Ast::lists, b: statement count.
+    scope,
+    // a: condition, b: scope, c: the following elif/else, or k_no_node.
+    stmt_if,
+    pred_elif,
+    // a: scope.
+    pred_else,
+    // Same as scope, for the top level. Always the last node.
+    prog,
+};
+
+struct AstNode {
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t c;
+};
+
+inline bool is_bin_expr(const NodeKind kind) {
+    return kind >= NodeKind::add && kind <= NodeKind::div;
+}
+
+// Which of a, b and c (bits 0, 1 and 2) can hold a child node. Scopes and
+// the prog node keep theirs in the lists instead.
+inline unsigned child_fields(const NodeKind kind) {
+    switch (kind) {
+        case NodeKind::add:
+        case NodeKind::sub:
+        case NodeKind::multi:
+        case NodeKind::div:
+            return 0b011;
+        case NodeKind::stmt_exit:
+        case NodeKind::pred_else:
+            return 0b001;
+        case NodeKind::stmt_let:
+        case NodeKind::stmt_assign:
+            return 0b010;
+        case NodeKind::stmt_if:
+        case NodeKind::pred_elif:
+            return 0b111;
+        default:
+            return 0;
+    }
+}
+
+// Applies `map` to every child index of `node` (k_no_node aside).
+template <typename Map>
+[[nodiscard]] AstNode map_children(const NodeKind kind, AstNode node, Map map) {
+    const unsigned fields = child_fields(kind);
+    std::uint32_t* const slots[] = { &node.a, &node.b, &node.c };
+    for (size_t idx = 0; idx < 3; idx++) {
+        if ((fields >> idx & 1) != 0 && *slots[idx] != k_no_node) {
+            *slots[idx] = map(*slots[idx]);
+        }
+    }
+    return node;
+}
+
+// `node` as it reads once its AST has been appended to arrays that already
+// held `node_base` nodes and `list_base` list entries.
+[[nodiscard]] inline AstNode relocate_node(const NodeKind kind, AstNode node, const std::uint32_t node_base,
+    const std::uint32_t list_base) {
+    if (kind == NodeKind::scope || kind == NodeKind::prog) {
+        node.a += list_base;
+        return node;
+    }
+    return map_children(kind, node, [&](const NodeIndex child) {
+        return child + node_base;
+    });
+}
+
+// Source offsets of a statement's first token (begin, end), or of a scope's
+// braces (`{`, `}`), plus where its last token starts. Only recorded on
+// request; see Parser::track_spans().
+struct SourceSpan {
+    std::uint32_t begin;
+    std::uint32_t end;
+    std::uint32_t last;
+};
+
+// Flat AST: node `idx` is kinds[idx] plus nodes[idx], children are indices
+// into the same arrays, and the statements of a scope sit next to each other
+// in `lists`. Children always come before their parents. The arrays live in
+// the parser's arena, and the struct itself is only a view of them.
+struct Ast {
+    ArenaSpan<NodeKind> kinds;
+    ArenaSpan<AstNode> nodes;
+    ArenaSpan<NodeIndex> lists;
+
+    [[nodiscard]] NodeIndex root() const {
+        return static_cast<NodeIndex>(kinds.size - 1);
+    }
+
+    [[nodiscard]] NodeKind kind(const NodeIndex idx) const {
+        return kinds[idx];
+    }
+
+    [[nodiscard]] const AstNode& node(const NodeIndex idx) const {
+        return nodes[idx];
+    }
+
+    // The statements of a scope or prog node.
+    [[nodiscard]] ArenaSpan<NodeIndex> stmts(const NodeIndex idx) const {
+        return { lists.data + nodes[idx].a, nodes[idx].b };
+    }
+
+    [[nodiscard]] std::uint64_t int_value(const NodeIndex idx) const {
+        return nodes[idx].a | static_cast<std::uint64_t>(nodes[idx].b) << 32;
+    }
+};
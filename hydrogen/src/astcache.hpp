@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./ast.hpp"
+#include "./symbols.hpp"
+
+// Identifies the sources the compiler was built from; the build sets it to a
+// hash of src/ (see CMakeLists.txt). Builds that do not set it share "dev"
+// and have to clear their cache files themselves.
+#ifndef HYDRO_BUILD_ID
+#define HYDRO_BUILD_ID "dev"
+#endif
+
+// Bump whenever the file layout changes. Changes to the node encoding or to
+// the AST the parser builds already change the build id.
+inline constexpr std::uint32_t k_ast_cache_format = 2;
+
+// What a cache file was built from. A file is only used when all of it
+// matches.
+struct AstCacheKey {
+    std::uint64_t source_hash;
+    std::uint64_t source_size;
+    std::uint64_t compiler_hash;
+    // 1 if the AST was built with --hash-cons, which shares expression nodes.
+    std::uint64_t hash_cons;
+
+    bool operator==(const AstCacheKey&) const = default;
+};
+
+// Four independent multiply-rotate lanes over 32-byte blocks, so hashing a
+// large source runs at memory speed rather than at one multiply latency per
+// word.
+inline std::uint64_t hash_bytes(const std::string_view bytes) {
+    constexpr std::uint64_t k_mul = 0x9E3779B97F4A7C15ull;
+    std::uint64_t lanes[4] = { bytes.size(), k_mul, ~bytes.size(), ~k_mul };
+    const auto mix = [](const std::uint64_t lane, const std::uint64_t word) {
+        return std::rotl((lane ^ word) * 0xBF58476D1CE4E5B9ull, 31);
+    };
+    size_t idx = 0;
+    for (; idx + 32 <= bytes.size(); idx += 32) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes.data() + idx + lane * 8, 8);
+            lanes[lane] = mix(lanes[lane], word);
+        }
+    }
+    for (size_t lane = 0; idx < bytes.size(); idx += 8, lane++) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes.data() + idx, std::min<size_t>(8, bytes.size() - idx));
+        lanes[lane] = mix(lanes[lane], word);
+    }
+    std::uint64_t hash = lanes[0];
+    for (size_t lane = 1; lane < 4; lane++) {
+        hash = mix(hash, lanes[lane]);
+    }
+    return hash ^ (hash >> 29);
+}
+
+inline AstCacheKey ast_cache_key(const std::string_view source, const bool hash_cons) {
+    return { hash_bytes(source), source.size(), hash_bytes(HYDRO_BUILD_ID), hash_cons };
+}
+
+// Layout of a cache file: this header, then the sections it points to, each
+// at a 64-byte aligned offset from the start of the file. The sections are
+// the Ast arrays and the symbol names exactly as they sit in memory, and
+// nodes refer to each other by index, so the file needs no fixing up
+// wherever it is mapped. Integers are in the byte order of the machine that
+// wrote the file; a file from another byte order fails the format check.
+struct AstCacheHeader {
+    struct Section {
+        std::uint64_t offset;
+        std::uint64_t count;
+    };
+
+    char magic[8];
+    std::uint32_t format;
+    std::uint32_t reserved;
+    AstCacheKey key;
+    Section kinds;
+    Section nodes;
+    Section lists;
+    Section name_offsets;
+    Section name_chars;
+};
+
+inline constexpr char k_ast_cache_magic[8] = { 'H', 'Y', 'D', 'R', 'O', 'A', 'S', 'T' };
+
+// A cache file mapped into memory. ast() and names() point straight into the
+// mapping, so loading one costs an mmap and a single pass over the nodes. The
+// mapping is copy-on-write, so the views are as writable as an Ast from the
+// parser, but nothing is ever written back to the file.
+//
+// The pass checks everything the passes after parsing rely on (see
+// valid_nodes()), so a truncated or damaged file is a cache miss rather than
+// a crash.
+class AstCacheFile {
+public:
+    // Empty if `path` does not exist, is not a cache file of this format, was
+    // written for a different key, or does not hold a well-formed AST.
+    static std::optional<AstCacheFile> open(const std::string& path, const AstCacheKey& key) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return {};
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || static_cast<size_t>(info.st_size) < sizeof(AstCacheHeader)) {
+            close(fd);
+            return {};
+        }
+        const auto size = static_cast<size_t>(info.st_size);
+        void* const map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return {};
+        }
+        AstCacheFile file(map, size);
+        if (!file.valid(key)) {
+            return {};
+        }
+        return file;
+    }
+
+    AstCacheFile(const AstCacheFile&) = delete;
+    AstCacheFile& operator=(const AstCacheFile&) = delete;
+
+    AstCacheFile(AstCacheFile&& other) noexcept
+        : m_map { std::exchange(other.m_map, nullptr) }
+        , m_size { std::exchange(other.m_size, 0) } {
+    }
+
+    AstCacheFile& operator=(AstCacheFile&& other) noexcept {
+        std::swap(m_map, other.m_map);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~AstCacheFile() {
+        if (m_map != nullptr) {
+            munmap(m_map, m_size);
+        }
+    }
+
+    [[nodiscard]] Ast ast() const {
+        const AstCacheHeader& head = header();
+        return {
+            { section<NodeKind>(head.kinds), head.kinds.count },
+            { section<AstNode>(head.nodes), head.nodes.count },
+            { section<NodeIndex>(head.lists), head.lists.count },
+        };
+    }
+
+    [[nodiscard]] SymbolNames names() const {
+        const AstCacheHeader& head = header();
+        return { section<std::uint32_t>(head.name_offsets), section<char>(head.name_chars), head.name_offsets.count,
+            head.name_chars.count };
+    }
+
+private:
+    AstCacheFile(void* const map, const size_t size) : m_map(map), m_size(size) {
+    }
+
+    [[nodiscard]] const AstCacheHeader& header() const {
+        return *static_cast<const AstCacheHeader*>(m_map);
+    }
+
+    template <typename T>
+    [[nodiscard]] T* section(const AstCacheHeader::Section& section) const {
+        return reinterpret_cast<T*>(static_cast<std::byte*>(m_map) + section.offset);
+    }
+
+    template <typename T>
+    [[nodiscard]] bool in_bounds(const AstCacheHeader::Section& section) const {
+        return section.offset % alignof(T) == 0 && section.offset <= m_size
+            && section.count <= (m_size - section.offset) / sizeof(T);
+    }
+
+    [[nodiscard]] bool valid(const AstCacheKey& key) const {
+        const AstCacheHeader& head = header();
+        if (std::memcmp(head.magic, k_ast_cache_magic, sizeof(k_ast_cache_magic)) != 0 || head.format != k_ast_cache_format
+            || head.key != key) {
+            return false;
+        }
+        if (!in_bounds<NodeKind>(head.kinds) || !in_bounds<AstNode>(head.nodes) || !in_bounds<NodeIndex>(head.lists)
+            || !in_bounds<std::uint32_t>(head.name_offsets) || !in_bounds<char>(head.name_chars)) {
+            return false;
+        }
+        return head.kinds.count > 0 && head.kinds.count == head.nodes.count
+            && section<NodeKind>(head.kinds)[head.kinds.count - 1] == NodeKind::prog && valid_names() && valid_nodes();
+    }
+
+    [[nodiscard]] bool valid_names() const {
+        const AstCacheHeader& head = header();
+        const std::uint32_t* const offsets = section<std::uint32_t>(head.name_offsets);
+        std::uint32_t prev = 0;
+        for (size_t id = 0; id < head.name_offsets.count; id++) {
+            if (offsets[id] < prev) {
+                return false;
+            }
+            prev = offsets[id];
+        }
+        return prev <= head.name_chars.count;
+    }
+
+    // Every node has a known kind, and the prog node is the last one. Every
+    // child comes before its parent and has a kind that fits its field, and
+    // only an if/elif may lack its successor. Statement lists lie inside the
+    // lists section and name statements that come before their scope. Every
+    // symbol has a name.
+    [[nodiscard]] bool valid_nodes() const {
+        const AstCacheHeader& head = header();
+        const NodeKind* const kinds = section<NodeKind>(head.kinds);
+        const AstNode* const nodes = section<AstNode>(head.nodes);
+        const NodeIndex* const lists = section<NodeIndex>(head.lists);
+        const size_t symbols = head.name_offsets.count;
+        for (NodeIndex idx = 0; idx < head.kinds.count; idx++) {
+            // A literal, an identifier or an operator.
+            const auto expr = [&](const NodeIndex child) {
+                return child < idx && kinds[child] <= NodeKind::div;
+            };
+            const auto of_kind = [&](const NodeIndex child, const NodeKind kind) {
+                return child < idx && kinds[child] == kind;
+            };
+            const AstNode& node = nodes[idx];
+            bool ok = false;
+            switch (kinds[idx]) {
+                case NodeKind::int_lit:
+                    ok = true;
+                    break;
+                case NodeKind::ident:
+                    ok = node.a < symbols;
+                    break;
+                case NodeKind::add:
+                case NodeKind::sub:
+                case NodeKind::multi:
+                case NodeKind::div:
+                    ok = expr(node.a) && expr(node.b);
+                    break;
+                case NodeKind::stmt_exit:
+                    ok = expr(node.a);
+                    break;
+                case NodeKind::stmt_let:
+                case NodeKind::stmt_assign:
+                    ok = node.a < symbols && expr(node.b);
+                    break;
+                case NodeKind::prog:
+                    if (idx + 1 != head.kinds.count) {
+                        return false;
+                    }
+                    [[fallthrough]];
+                case NodeKind::scope:
+                    ok = node.a <= head.lists.count && node.b <= head.lists.count - node.a;
+                    for (size_t pos = node.a; ok && pos < size_t { node.a } + node.b; pos++) {
+                        // exit, let, assign, a scope or an if.
+                        const NodeIndex stmt = lists[pos];
+                        ok = stmt < idx && kinds[stmt] >= NodeKind::stmt_exit && kinds[stmt] <= NodeKind::stmt_if;
+                    }
+                    break;
+                case NodeKind::stmt_if:
+                case NodeKind::pred_elif:
+                    ok = expr(node.a) && of_kind(node.b, NodeKind::scope)
+                        && (node.c == k_no_node || of_kind(node.c, NodeKind::pred_elif) || of_kind(node.c, NodeKind::pred_else));
+                    break;
+                case NodeKind::pred_else:
+                    ok = of_kind(node.a, NodeKind::scope);
+                    break;
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void* m_map;
+    size_t m_size;
+};
+
+// Writes `ast` and `names` as a cache file for `key`. The file is written
+// next to `path` and renamed over it, so a concurrent reader sees either the
+// old file or the complete new one.
+inline void write_ast_cache(const std::string& path, const AstCacheKey& key, const Ast& ast, const SymbolNames names) {
+    constexpr size_t k_align = 64;
+    AstCacheHeader head {};
+    std::memcpy(head.magic, k_ast_cache_magic, sizeof(k_ast_cache_magic));
+    head.format = k_ast_cache_format;
+    head.key = key;
+
+    size_t offset = sizeof(AstCacheHeader);
+    const auto place = [&](AstCacheHeader::Section& section, const size_t count, const size_t elem_size) {
+        offset = (offset + k_align - 1) / k_align * k_align;
+        section = { offset, count };
+        offset += count * elem_size;
+    };
+    place(head.kinds, ast.kinds.size, sizeof(NodeKind));
+    place(head.nodes, ast.nodes.size, sizeof(AstNode));
+    place(head.lists, ast.lists.size, sizeof(NodeIndex));
+    place(head.name_offsets, names.count, sizeof(std::uint32_t));
+    place(head.name_chars, names.chars_size, sizeof(char));
+
+    const std::string temp_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        size_t written = 0;
+        const auto write = [&](const AstCacheHeader::Section& section, const void* data, const size_t bytes) {
+            static constexpr char k_padding[k_align] {};
+            file.write(k_padding, static_cast<std::streamsize>(section.offset - written));
+            file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+            written = section.offset + bytes;
+        };
+        write({ 0, 1 }, &head, sizeof(head));
+        write(head.kinds, ast.kinds.data, ast.kinds.size * sizeof(NodeKind));
+        write(head.nodes, ast.nodes.data, ast.nodes.size * sizeof(AstNode));
+        write(head.lists, ast.lists.data, ast.lists.size * sizeof(NodeIndex));
+        write(head.name_offsets, names.offsets, names.count * sizeof(std::uint32_t));
+        write(head.name_chars, names.chars, names.chars_size);
+        file.close();
+        if (!file) {
+            std::cerr << "Could not write " << temp_path << std::endl;
+            std::remove(temp_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not write " << path << ": " << std::strerror(errno) << std::endl;
+        std::remove(temp_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "./ir.hpp"
+
+// Replaces arithmetic on constants with its result (see fold_bin_op()), in
+// place. The operands are left for dce. Running it again after simplify-cfg
+// catches constants that pass exposes, such as a phi that turned out to
+// have one value.
+class ConstantFolding {
+public:
+    explicit ConstantFolding(Ir& ir) : m_ir(ir) {
+    }
+
+    // Returns the number of instructions folded.
+    size_t run() {
+        size_t folded = 0;
+        // Operands come before their users, so a chain folds in one pass.
+        for (ValueId inst = 0; inst < m_ir.insts.size(); inst++) {
+            const IrInst& fields = m_ir.insts[inst];
+            if (!is_bin_op(m_ir.ops[inst]) || m_ir.ops[fields.a] != IrOp::const_
+                || m_ir.ops[fields.b] != IrOp::const_) {
+                continue;
+            }
+            const std::optional<std::uint64_t> value
+                = fold_bin_op(m_ir.ops[inst], m_ir.const_value(fields.a), m_ir.const_value(fields.b));
+            if (value.has_value()) {
+                m_ir.ops[inst] = IrOp::const_;
+                m_ir.insts[inst] = { static_cast<std::uint32_t>(value.value()),
+                    static_cast<std::uint32_t>(value.value() >> 32), 0 };
+                folded++;
+            }
+        }
+        return folded;
+    }
+
+private:
+    Ir& m_ir;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./ir.hpp"
+
+// Removes instructions whose values are never used, and then whatever only
+// they used. A division is kept unless its divisor is a nonzero constant,
+// as dividing by zero stops the program.
+class DeadCodeElimination {
+public:
+    explicit DeadCodeElimination(Ir& ir) : m_ir(ir), m_uses(ir.insts.size(), 0) {
+    }
+
+    // Returns the number of instructions removed.
+    size_t run() {
+        for (ValueId inst = 0; inst < m_ir.insts.size(); inst++) {
+            m_ir.for_each_operand(inst, [&](const ValueId value) {
+                m_uses[value]++;
+            });
+        }
+        std::vector<ValueId> dead;
+        for (ValueId inst = 0; inst < m_ir.insts.size(); inst++) {
+            if (m_uses[inst] == 0 && is_removable(inst)) {
+                dead.push_back(inst);
+            }
+        }
+        IrEditor editor(m_ir);
+        size_t removed = 0;
+        while (!dead.empty()) {
+            const ValueId inst = dead.back();
+            dead.pop_back();
+            editor.remove(inst);
+            removed++;
+            m_ir.for_each_operand(inst, [&](const ValueId value) {
+                if (--m_uses[value] == 0 && is_removable(value)) {
+                    dead.push_back(value);
+                }
+            });
+        }
+        if (removed > 0) {
+            editor.commit();
+        }
+        return removed;
+    }
+
+private:
+    [[nodiscard]] bool is_removable(const ValueId inst) const {
+        const IrOp op = m_ir.ops[inst];
+        if (op == IrOp::div) {
+            const ValueId divisor = m_ir.insts[inst].b;
+            return m_ir.ops[divisor] == IrOp::const_ && m_ir.const_value(divisor) != 0;
+        }
+        return has_value(op);
+    }
+
+    Ir& m_ir;
+    std::vector<std::uint32_t> m_uses;
+};
@@ -1,257 +1,487 @@
 #pragma once
 
-#include "parser.hpp"
-#include <cassert>
 #include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <queue>
+#include <set>
+#include <string_view>
+#include <vector>
 
+#include "./ir.hpp"
+
+// Where a value lives between its definition and its last use. Constants
+// live nowhere: their uses take them as immediates.
+struct Location {
+    enum class Kind : std::uint8_t {
+        none,
+        reg,
+        stack,
+    };
+
+    Kind kind;
+    // Register number (see k_reg_names), or stack slot.
+    std::uint32_t index;
+
+    bool operator==(const Location&) const = default;
+};
+
+// x86-64 code for an Ir, in NASM syntax.
+//
+// Values get registers by linear scan over the instructions in block order,
+// which the IR keeps topologically sorted, so a value's live range is the
+// interval from its definition to its last use. When registers run out, the
+// value whose interval ends last is moved to a stack slot. Phis are resolved
+// by parallel moves on each incoming edge, on a path of their own when the
+// edge leaves a branch.
+//
+// rax, rdx and r11 are never allocated: rax and rdx are taken by div, and
+// all three serve as scratch registers.
 class Generator {
 public:
-    inline explicit Generator(NodeProg prog) : m_prog(std::move(prog)) {
+    // `ir` has to have passed IrVerifier. The assembly is written to
+    // `output` as it is generated.
+    Generator(const Ir& ir, std::ostream& output) : m_ir(ir), m_output(output) {
     }
 
-    void gen_term(const NodeTerm* term) {
-        struct TermVisitor {
-            Generator& gen;
-            void operator()(const NodeTermIntLit* term_int_lit) const {
-                gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen.push("rax");
-            }
-            void operator()(const NodeTermIdent* term_ident) const {
-                const auto it = std::ranges::find_if(std::as_const(gen.m_vars), [&](const Var& var) {
-                    return var.name == term_ident->ident.value.value();
-                });
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                gen.push(offset.str());
-            }
-            void operator()(const NodeTermParen* term_paren) const {
-                gen.gen_expr(term_paren->expr);
-            }
-        };
-        TermVisitor visitor({ .gen = *this });
-        std::visit(visitor, term->var);
+    void gen_prog() {
+        allocate();
+        m_output << "global _start\n_start:\n";
+        if (m_frame_size > 0) {
+            m_output << "    sub rsp, ";
+            write_number(m_frame_size * 8);
+            m_output << "\n";
+        }
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            gen_block(block);
+        }
     }
 
-    void gen_bin_expr(const NodeBinExpr* bin_expr) {
-        struct BinExprVisitor {
-            Generator& gen;
-            void operator()(const NodeBinExprSub* sub) const {
-                gen.m_output << "    ;; sub\n";
-                gen.gen_expr(sub->rght_hnd_side);
-                gen.gen_expr(sub->lft_hnd_side);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    sub rax, rbx\n";
-                gen.push("rax");
-                gen.m_output << "    ;; /sub\n";
-            }
-            void operator()(const NodeBinExprAdd* add) const {
-                gen.m_output << "    ;; add\n";
-                gen.gen_expr(add->rght_hnd_side);
-                gen.gen_expr(add->lft_hnd_side);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    add rax, rbx\n";
-                gen.push("rax");
-                gen.m_output << "    ;; /add\n";
-            }
-            void operator()(const NodeBinExprMulti* multi) const {
-                gen.m_output << "    ;; multi\n";
-                gen.gen_expr(multi->rght_hnd_side);
-                gen.gen_expr(multi->lft_hnd_side);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    mul rbx\n";
-                gen.push("rax");
-                gen.m_output << "    ;; /multi\n";
-            }
-            void operator()(const NodeBinExprDiv* div) const {
-                gen.m_output << "    ;; div\n";
-                gen.gen_expr(div->rght_hnd_side);
-                gen.gen_expr(div->lft_hnd_side);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    div rbx\n";
-                gen.push("rax");
-                gen.m_output << "    ;; /div\n";
+private:
+    void gen_block(const BlockId block) {
+        if (block > 0) {
+            write_label(block);
+            m_output << ":\n";
+        }
+        const IrBlock& range = m_ir.blocks[block];
+        for (ValueId inst = range.first; inst + 1 < range.end; inst++) {
+            if (is_bin_op(m_ir.ops[inst])) {
+                gen_bin_op(inst);
             }
-        };
-        BinExprVisitor visitor { .gen = *this };
-        std::visit(visitor, bin_expr->var);
+        }
+        const ValueId last = range.end - 1;
+        const IrInst& fields = m_ir.insts[last];
+        switch (m_ir.ops[last]) {
+            case IrOp::jump:
+                gen_edge(block, fields.a);
+                break;
+            case IrOp::branch:
+                gen_branch(block, fields);
+                break;
+            case IrOp::exit:
+                m_output << "    mov rax, 60\n";
+                move({ Location::Kind::reg, k_rdi }, operand(fields.a));
+                m_output << "    syscall\n";
+                break;
+            default:
+                assert(false); // Unreachable;
+        }
     }
 
-    void gen_expr(const NodeExpr* expr) {
-        struct ExprVisitor {
-            Generator& gen;
-            void operator()(const NodeTerm* term) const {
-                gen.gen_term(term);
-            }
-            void operator()(const NodeBinExpr* bin_expr) const {
-                gen.gen_bin_expr(bin_expr);
+    void gen_bin_op(const ValueId inst) {
+        const IrOp op = m_ir.ops[inst];
+        const Location dst = m_locs[inst];
+        const Operand lhs = operand(m_ir.insts[inst].a);
+        if (op == IrOp::div) {
+            const Operand rhs = rm_operand(operand(m_ir.insts[inst].b), false);
+            move({ Location::Kind::reg, k_rax }, lhs);
+            m_output << "    xor edx, edx\n";
+            m_output << "    div ";
+            write_operand(rhs);
+            m_output << "\n";
+            move(dst, { false, 0, { Location::Kind::reg, k_rax } });
+            return;
+        }
+        // Neither operand is in dst's register: they are still live while
+        // dst is defined.
+        const Location acc = dst.kind == Location::Kind::reg ? dst : Location { Location::Kind::reg, k_rax };
+        const Operand rhs = rm_operand(operand(m_ir.insts[inst].b), true);
+        move(acc, lhs);
+        if (op == IrOp::mul) {
+            m_output << "    imul ";
+            write_location(acc);
+            if (rhs.is_const && fits_imm32(rhs.value)) {
+                m_output << ", ";
+                write_location(acc);
             }
-        };
-        ExprVisitor visitor { .gen = *this };
-        std::visit(visitor, expr->var);
+        }
+        else {
+            m_output << (op == IrOp::add ? "    add " : "    sub ");
+            write_location(acc);
+        }
+        m_output << ", ";
+        write_operand(rhs);
+        m_output << "\n";
+        move(dst, { false, 0, acc });
     }
 
-    void gen_scope(const NodeScope* scope) {
-        begin_scope();
-        for (const NodeStmt* stmt : scope->stmts) {
-            gen_stmt(stmt);
+    void gen_branch(const BlockId block, const IrInst& fields) {
+        const Operand cond = operand(fields.a);
+        if (cond.is_const) {
+            gen_edge(block, cond.value != 0 ? fields.b : fields.c);
+            return;
+        }
+        if (cond.location.kind == Location::Kind::reg) {
+            m_output << "    test ";
+            write_location(cond.location);
+            m_output << ", ";
+            write_location(cond.location);
+        }
+        else {
+            m_output << "    cmp ";
+            write_location(cond.location);
+            m_output << ", 0";
+        }
+        m_output << "\n";
+        // The side without phi moves is jumped to straight away.
+        if (!has_phis(fields.c)) {
+            m_output << "    jz ";
+            write_label(fields.c);
+            m_output << "\n";
+            gen_edge(block, fields.b);
+        }
+        else if (!has_phis(fields.b)) {
+            m_output << "    jnz ";
+            write_label(fields.b);
+            m_output << "\n";
+            gen_edge(block, fields.c);
+        }
+        else {
+            m_output << "    jz ";
+            write_label(block);
+            m_output << "_zero\n";
+            gen_edge(block, fields.b, false);
+            write_label(block);
+            m_output << "_zero:\n";
+            gen_edge(block, fields.c);
         }
-        end_scope();
     }
 
-    void gen_if_pred(const NodeIfPred* pred, const std::string& end_label) {
-        struct PredVisitor {
-            Generator& gen;
-            const std::string& end_label;
-            void operator()(const NodeIfPredElif* elif) const {
-                gen.m_output << "    ;; elif\n";
-                gen.gen_expr(elif->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
-                gen.gen_scope(elif->scope);
-                gen.m_output << "    jmp " << end_label << "\n";
-                if (elif->pred.has_value()) {
-                    gen.m_output << label << ":\n";
-                    gen.gen_if_pred(elif->pred.value(), end_label);
+    // Control going from `from` to `to`: the phi moves, and a jump unless
+    // `to` comes next and may be fallen into.
+    void gen_edge(const BlockId from, const BlockId to, const bool fall_through = true) {
+        m_moves.clear();
+        for (ValueId inst = m_ir.blocks[to].first; m_ir.ops[inst] == IrOp::phi; inst++) {
+            const IrInst& fields = m_ir.insts[inst];
+            for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                if (m_ir.phi_args[idx].block == from) {
+                    const Operand src = operand(m_ir.phi_args[idx].value);
+                    if (src.is_const || src.location != m_locs[inst]) {
+                        m_moves.push_back({ m_locs[inst], src });
+                    }
                 }
-                gen.m_output << "    ;; /elif\n";
-            }
-            void operator()(const NodeIfPredElse* else_) const {
-                gen.gen_scope(else_->scope);
             }
-        };
-        PredVisitor visitor { .gen = *this, .end_label = end_label };
-        std::visit(visitor, pred->var);
+        }
+        parallel_move();
+        if (to != from + 1 || !fall_through) {
+            m_output << "    jmp ";
+            write_label(to);
+            m_output << "\n";
+        }
     }
 
-    void gen_stmt(const NodeStmt* stmt) {
-        struct StmtVisitor {
-            Generator& gen;
-            void operator()(const NodeStmtExit* stmt_exit) const {
-                gen.m_output << "    ;; exit\n";
-                gen.gen_expr(stmt_exit->expr);
-                gen.m_output << "    mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "    syscall\n";
-                gen.m_output << "    ;; /exit\n";
+    // Performs m_moves as if all at once. Moves whose destination no other
+    // move still reads go first. What is left then are cycles, each broken
+    // by parking one destination's old value in r11.
+    void parallel_move() {
+        for (size_t idx = 0; idx < m_moves.size(); idx++) {
+            m_writers[key(m_moves[idx].dst)] = static_cast<std::uint32_t>(idx + 1);
+            if (!m_moves[idx].src.is_const) {
+                m_reads[key(m_moves[idx].src.location)]++;
             }
-            void operator()(const NodeStmtLet* stmt_let) const {
-                gen.m_output << "    ;; let\n";
-                if (std::ranges::find_if(std::as_const(gen.m_vars), [&](const Var& var) {
-                        return var.name == stmt_let->ident.value.value();
-                    }) != gen.m_vars.cend()) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-
-                gen.m_vars.push_back({ .name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size });
-                gen.gen_expr(stmt_let->expr);
-                gen.m_output << "    ;; /let\n";
+        }
+        m_ready.clear();
+        for (size_t idx = 0; idx < m_moves.size(); idx++) {
+            if (m_reads[key(m_moves[idx].dst)] == 0) {
+                m_ready.push_back(static_cast<std::uint32_t>(idx));
             }
-            void operator()(const NodeStmtAssign* stmt_assign) const {
-                const auto it = std::ranges::find_if(gen.m_vars, [&](const Var& var) {
-                    return var.name == stmt_assign->ident.value.value();
-                });
-                if (it == gen.m_vars.end()) {
-                    std::cerr << "Undeclared identifier: " << stmt_assign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+        }
+        size_t done = 0;
+        size_t next = 0;
+        while (done < m_moves.size()) {
+            while (!m_ready.empty()) {
+                Move& ready = m_moves[m_ready.back()];
+                m_ready.pop_back();
+                move(ready.dst, ready.src);
+                ready.done = true;
+                done++;
+                if (ready.src.is_const || ready.src.location == Location { Location::Kind::reg, k_r11 }) {
+                    continue;
+                }
+                const size_t src = key(ready.src.location);
+                if (--m_reads[src] == 0 && m_writers[src] != 0 && !m_moves[m_writers[src] - 1].done) {
+                    m_ready.push_back(m_writers[src] - 1);
                 }
-                gen.gen_expr(stmt_assign->expr);
-                gen.pop("rax");
-                gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
             }
-            void operator()(const NodeScope* scope) const {
-                gen.m_output << "    ;; scope\n";
-                gen.gen_scope(scope);
-                gen.m_output << "    ;; /scope\n";
+            if (done == m_moves.size()) {
+                break;
             }
-            void operator()(const NodeStmtIf* stmt_if) const {
-                gen.m_output << "    ;; if\n";
-                gen.gen_expr(stmt_if->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
-                gen.gen_scope(stmt_if->scope);
-                if (stmt_if->pred.has_value()) {
-                    const std::string end_label = gen.create_label();
-                    gen.m_output << "    jmp " << end_label << "\n";
-                    gen.m_output << label << ":\n";
-                    gen.gen_if_pred(stmt_if->pred.value(), end_label);
-                    gen.m_output << end_label << ":\n";
-                }
-                else {
-                    gen.m_output << label << ":\n";
-                }
-                gen.m_output << "    ;; /if\n";
+            while (m_moves[next].done) {
+                next++;
             }
-        };
-        StmtVisitor visitor { .gen = *this };
-        std::visit(visitor, stmt->var);
+            // Walk the cycle back to the move that reads this one's
+            // destination.
+            Move& first = m_moves[next];
+            size_t reader = next;
+            while (!(m_moves[reader].src.location == first.dst)) {
+                reader = m_writers[key(m_moves[reader].src.location)] - 1;
+            }
+            const Location r11 { Location::Kind::reg, k_r11 };
+            move(r11, { false, 0, first.dst });
+            m_moves[reader].src.location = r11;
+            m_reads[key(first.dst)] = 0;
+            m_ready.push_back(static_cast<std::uint32_t>(next));
+        }
+        for (const Move& entry : m_moves) {
+            m_writers[key(entry.dst)] = 0;
+        }
     }
 
-    [[nodiscard]] std::string gen_prog() {
-        m_output << "global _start\n_start:\n";
+    // A value as an operand: a constant, or where it lives.
+    struct Operand {
+        bool is_const;
+        std::uint64_t value;
+        Location location;
+    };
 
-        for (const NodeStmt* stmt : m_prog.stmts) {
-            gen_stmt(stmt);
+    [[nodiscard]] Operand operand(const ValueId value) const {
+        if (m_ir.ops[value] == IrOp::const_) {
+            return { true, m_ir.const_value(value), { Location::Kind::none, 0 } };
         }
+        return { false, 0, m_locs[value] };
+    }
 
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
-        return m_output.str();
+    void move(const Location dst, const Operand src) {
+        if (!src.is_const && src.location == dst) {
+            return;
+        }
+        if (dst.kind == Location::Kind::stack && !src.is_const && src.location.kind == Location::Kind::stack) {
+            move({ Location::Kind::reg, k_rax }, src);
+            move(dst, { false, 0, { Location::Kind::reg, k_rax } });
+            return;
+        }
+        if (dst.kind == Location::Kind::stack && src.is_const && !fits_imm32(src.value)) {
+            move({ Location::Kind::reg, k_rax }, src);
+            move(dst, { false, 0, { Location::Kind::reg, k_rax } });
+            return;
+        }
+        m_output << "    mov ";
+        write_location(dst);
+        m_output << ", ";
+        if (src.is_const) {
+            write_imm(src.value, dst.kind == Location::Kind::stack);
+        }
+        else {
+            write_location(src.location);
+        }
+        m_output << "\n";
     }
-private:
 
-    void push(const std::string& reg) {
-        m_output << "    push " << reg << "\n";
-        m_stack_size++;
+    // `src` as the last operand of an instruction: a register, memory, or
+    // with `imm32_ok` an immediate that fits. Other constants are loaded
+    // into r11 first.
+    Operand rm_operand(const Operand src, const bool imm32_ok) {
+        if (!src.is_const || (imm32_ok && fits_imm32(src.value))) {
+            return src;
+        }
+        const Location r11 { Location::Kind::reg, k_r11 };
+        move(r11, src);
+        return { false, 0, r11 };
+    }
+
+    void write_operand(const Operand& src) {
+        if (src.is_const) {
+            write_imm(src.value, true);
+        }
+        else {
+            write_location(src.location);
+        }
+    }
+
+    static bool fits_imm32(const std::uint64_t value) {
+        const auto signed_value = static_cast<std::int64_t>(value);
+        return signed_value >= INT32_MIN && signed_value <= INT32_MAX;
+    }
+
+    // Sign-extended 32-bit immediates are written as signed numbers.
+    void write_imm(const std::uint64_t value, const bool imm32) {
+        if (imm32) {
+            write_number(static_cast<std::int64_t>(value));
+        }
+        else {
+            write_number(value);
+        }
+    }
+
+    void write_location(const Location location) {
+        if (location.kind == Location::Kind::reg) {
+            m_output << k_reg_names[location.index];
+            return;
+        }
+        m_output << "QWORD [rsp + ";
+        write_number(location.index * 8);
+        m_output << "]";
     }
 
-    void pop(const std::string& reg) {
-        m_output << "    pop " << reg << "\n";
-        m_stack_size--;
+    // Labels are emitted as "block<n>".
+    void write_label(const BlockId block) {
+        m_output << "block";
+        write_number(block);
     }
 
-    void begin_scope() {
-        m_scopes.push_back(m_vars.size());
+    template <typename Number>
+    void write_number(const Number value) {
+        char digits[24];
+        const char* const end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        m_output.write(digits, end - digits);
     }
 
-    void end_scope() {
-        const size_t pop_count = m_vars.size() - m_scopes.back();
-        m_output << "    add rsp, " << pop_count * 8 << "\n";
-        m_stack_size -= pop_count;
-        for (size_t idx = 0; idx < pop_count; idx++) {
-            m_vars.pop_back();
-        }
-        m_scopes.pop_back();
+    [[nodiscard]] bool has_phis(const BlockId block) const {
+        return m_ir.ops[m_ir.blocks[block].first] == IrOp::phi;
     }
 
-    std::string create_label() {
-        std::stringstream strstream;
-        strstream << "label" << m_label_count++;
-        return strstream.str();
+    // Register number, or k_reg_count + stack slot.
+    [[nodiscard]] static size_t key(const Location location) {
+        return location.kind == Location::Kind::reg ? location.index : k_reg_count + location.index;
     }
 
-    struct Var {
-        std::string name;
-        size_t stack_loc;
+    // Linear scan. A value's interval runs from its definition (a phi's
+    // from the start of its block) to its last use (a phi argument's at the
+    // end of the predecessor it comes from). An interval that ends where
+    // another starts still holds on to its register, so an instruction's
+    // result never shares a location with its operands.
+    void allocate() {
+        const size_t count = m_ir.insts.size();
+        m_locs.assign(count, { Location::Kind::none, 0 });
+        std::vector<std::uint32_t> starts(count);
+        std::vector<std::uint32_t> ends(count);
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            const IrBlock& range = m_ir.blocks[block];
+            for (ValueId inst = range.first; inst < range.end; inst++) {
+                starts[inst] = m_ir.ops[inst] == IrOp::phi ? range.first : inst;
+                ends[inst] = starts[inst];
+            }
+        }
+        for (ValueId inst = 0; inst < count; inst++) {
+            if (m_ir.ops[inst] == IrOp::phi) {
+                const IrInst& fields = m_ir.insts[inst];
+                for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                    const PhiArg& arg = m_ir.phi_args[idx];
+                    ends[arg.value] = std::max(ends[arg.value], m_ir.blocks[arg.block].end - 1);
+                }
+            }
+            else {
+                m_ir.for_each_operand(inst, [&](const ValueId value) {
+                    ends[value] = std::max(ends[value], inst);
+                });
+            }
+        }
+
+        // By end, so the first to expire and the last to end are at hand.
+        std::set<std::pair<std::uint32_t, ValueId>> active;
+        std::vector<std::uint32_t> free_regs(std::rbegin(k_allocatable), std::rend(k_allocatable));
+        // Stack slots in use, by end, and free ones, with the end of their
+        // last value, oldest first.
+        using SlotUse = std::pair<std::uint32_t, std::uint32_t>;
+        std::priority_queue<SlotUse, std::vector<SlotUse>, std::greater<>> used_slots;
+        std::deque<SlotUse> free_slots;
+        const auto take_slot = [&](const ValueId value, const bool reuse_any) {
+            std::uint32_t slot = m_frame_size;
+            if (reuse_any && !free_slots.empty()) {
+                slot = free_slots.back().second;
+                free_slots.pop_back();
+            }
+            else if (!reuse_any && !free_slots.empty() && free_slots.front().first < starts[value]) {
+                slot = free_slots.front().second;
+                free_slots.pop_front();
+            }
+            else {
+                m_frame_size++;
+            }
+            used_slots.push({ ends[value], slot });
+            m_locs[value] = { Location::Kind::stack, slot };
+        };
+
+        for (ValueId value = 0; value < count; value++) {
+            const IrOp op = m_ir.ops[value];
+            if (!has_value(op) || op == IrOp::const_) {
+                continue;
+            }
+            const std::uint32_t start = starts[value];
+            while (!active.empty() && active.begin()->first < start) {
+                free_regs.push_back(m_locs[active.begin()->second].index);
+                active.erase(active.begin());
+            }
+            while (!used_slots.empty() && used_slots.top().first < start) {
+                free_slots.push_back(used_slots.top());
+                used_slots.pop();
+            }
+            if (!free_regs.empty()) {
+                m_locs[value] = { Location::Kind::reg, free_regs.back() };
+                free_regs.pop_back();
+                active.insert({ ends[value], value });
+                continue;
+            }
+            const auto last = std::prev(active.end());
+            if (last->first > ends[value]) {
+                // The register is only taken over from here on, but the
+                // spilled value is on the stack for its whole interval.
+                const ValueId spilled = last->second;
+                m_locs[value] = m_locs[spilled];
+                active.erase(last);
+                active.insert({ ends[value], value });
+                take_slot(spilled, false);
+            }
+            else {
+                take_slot(value, true);
+            }
+        }
+        m_reads.assign(k_reg_count + m_frame_size, 0);
+        m_writers.assign(k_reg_count + m_frame_size, 0);
+    }
+
+    struct Move {
+        Location dst;
+        Operand src;
+        bool done = false;
+    };
+
+    static constexpr size_t k_reg_count = 16;
+    // In encoding order, so that a register's number is its index.
+    static constexpr std::string_view k_reg_names[k_reg_count] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
     };
+    static constexpr std::uint32_t k_rax = 0;
+    static constexpr std::uint32_t k_rdi = 7;
+    static constexpr std::uint32_t k_r11 = 11;
+    // Handed out in this order.
+    static constexpr std::uint32_t k_allocatable[] = { 3, 1, 6, 7, 8, 9, 10, 12, 13, 14, 15, 5 };
 
-    const NodeProg m_prog;
-    std::stringstream m_output;
-    size_t m_stack_size = 0;
-    std::vector<Var> m_vars {};
-    std::vector<size_t> m_scopes {};
-    int m_label_count = 0;
+    const Ir& m_ir;
+    std::ostream& m_output;
+    // Per value.
+    std::vector<Location> m_locs {};
+    std::uint32_t m_frame_size = 0;
+    std::vector<Move> m_moves {};
+    std::vector<std::uint32_t> m_ready {};
+    // Per register and stack slot: how many pending moves read it, and
+    // which one (plus one) writes it.
+    std::vector<std::uint32_t> m_reads {};
+    std::vector<std::uint32_t> m_writers {};
 };
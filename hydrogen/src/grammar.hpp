@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "./ast.hpp"
+#include "tokenization.hpp"
+
+// The grammar as data; docs/grammar.md is generated from it (see
+// tests/grammar_doc.cpp). The parser never walks these productions itself:
+// the tables it does consult (which rule a token starts, operator
+// precedences) are derived from them at compile time, the same way the
+// tokenizer's DFA is. Adding a rule adds a table entry, not another try.
+
+enum class NonTerminal : std::uint8_t {
+    stmt,
+    // Zero or more Stmt.
+    stmts,
+    scope,
+    // Also derives the empty string, which is what the parser falls back to
+    // when no IfPred rule matches.
+    if_pred,
+    expr,
+};
+
+constexpr bool derives_empty(const NonTerminal nonterminal) {
+    return nonterminal == NonTerminal::stmts || nonterminal == NonTerminal::if_pred;
+}
+
+// One production each. Expr is handled by the operator table instead.
+enum class Rule : std::uint8_t {
+    none,
+    exit,
+    let,
+    assign,
+    if_,
+    block,
+    scope,
+    elif,
+    else_,
+};
+
+struct GrammarSymbol {
+    bool terminal;
+    TokenType token;
+    NonTerminal nonterminal;
+};
+
+constexpr GrammarSymbol term(const TokenType token) {
+    return { true, token, NonTerminal::stmt };
+}
+
+constexpr GrammarSymbol nonterm(const NonTerminal nonterminal) {
+    return { false, TokenType::exit, nonterminal };
+}
+
+inline constexpr size_t k_max_rhs = 8;
+inline constexpr size_t k_max_lookahead = 3;
+
+struct Production {
+    NonTerminal lhs;
+    Rule rule;
+    // How many leading terminals have to match before the parser commits to
+    // the rule (the k of LL(k)). If they do not, the rule is not tried, and
+    // it is up to the caller what that means (end of scope, mostly).
+    std::uint8_t lookahead;
+    std::uint8_t length;
+    std::array<GrammarSymbol, k_max_rhs> rhs;
+};
+
+// In Rule order.
+inline constexpr Production k_productions[] = {
+    { NonTerminal::stmt, Rule::exit, 2, 5,
+        { term(TokenType::exit), term(TokenType::open_paren), nonterm(NonTerminal::expr), term(TokenType::close_paren),
+            term(TokenType::semi) } },
+    { NonTerminal::stmt, Rule::let, 3, 5,
+        { term(TokenType::let), term(TokenType::ident), term(TokenType::eq), nonterm(NonTerminal::expr),
+            term(TokenType::semi) } },
+    { NonTerminal::stmt, Rule::assign, 2, 4,
+        { term(TokenType::ident), term(TokenType::eq), nonterm(NonTerminal::expr), term(TokenType::semi) } },
+    { NonTerminal::stmt, Rule::if_, 1, 6,
+        { term(TokenType::if_), term(TokenType::open_paren), nonterm(NonTerminal::expr), term(TokenType::close_paren),
+            nonterm(NonTerminal::scope), nonterm(NonTerminal::if_pred) } },
+    { NonTerminal::stmt, Rule::block, 1, 1, { nonterm(NonTerminal::scope) } },
+    { NonTerminal::scope, Rule::scope, 1, 3,
+        { term(TokenType::open_curly), nonterm(NonTerminal::stmts), term(TokenType::close_curly) } },
+    { NonTerminal::if_pred, Rule::elif, 1, 6,
+        { term(TokenType::elif), term(TokenType::open_paren), nonterm(NonTerminal::expr), term(TokenType::close_paren),
+            nonterm(NonTerminal::scope), nonterm(NonTerminal::if_pred) } },
+    { NonTerminal::if_pred, Rule::else_, 1, 2, { term(TokenType::else_), nonterm(NonTerminal::scope) } },
+};
+
+struct BinaryOperator {
+    TokenType token;
+    // Higher binds tighter. All operators are left-associative.
+    int prec;
+    NodeKind kind;
+};
+
+inline constexpr BinaryOperator k_binary_operators[] = {
+    { TokenType::star, 1, NodeKind::multi },
+    { TokenType::fslash, 1, NodeKind::div },
+    { TokenType::plus, 0, NodeKind::add },
+    { TokenType::minus, 0, NodeKind::sub },
+};
+
+// Entry of a dispatch table: the rule started by the token it is indexed by,
+// and the terminals that have to follow before the parser commits to it.
+struct RuleDispatch {
+    Rule rule;
+    std::uint8_t lookahead;
+    std::array<TokenType, k_max_lookahead> prefix;
+};
+
+// Adds FIRST(`symbol`) to `first`. Only the first symbol of a production
+// is looked at, so no production may start with a nonterminal that
+// derives the empty string (valid_production() checks).
+constexpr void add_first_tokens(const GrammarSymbol symbol, std::array<bool, k_token_type_count>& first) {
+    if (symbol.terminal) {
+        first[static_cast<size_t>(symbol.token)] = true;
+        return;
+    }
+    for (const Production& production : k_productions) {
+        if (production.lhs == symbol.nonterminal) {
+            add_first_tokens(production.rhs[0], first);
+        }
+    }
+}
+
+constexpr bool valid_production(const Production& production, const size_t idx) {
+    if (production.rule != static_cast<Rule>(idx + 1) || production.lookahead < 1
+        || production.lookahead > k_max_lookahead || production.lookahead > production.length) {
+        return false;
+    }
+    // Only the first symbol may be a nonterminal.
+    for (size_t pos = 1; pos < production.lookahead; pos++) {
+        if (!production.rhs[pos].terminal) {
+            return false;
+        }
+    }
+    if (!production.rhs[0].terminal && derives_empty(production.rhs[0].nonterminal)) {
+        return false;
+    }
+    return production.lookahead == 1 || production.rhs[0].terminal;
+}
+
+// Indexed by the current token. Only built for nonterminals whose
+// alternatives have disjoint FIRST sets; dispatch_table() reports a
+// conflict as an empty optional, which fails the static_assert below.
+constexpr std::optional<std::array<RuleDispatch, k_token_type_count>> dispatch_table(const NonTerminal lhs) {
+    std::array<RuleDispatch, k_token_type_count> table {};
+    for (size_t idx = 0; idx < std::size(k_productions); idx++) {
+        const Production& production = k_productions[idx];
+        if (production.lhs != lhs) {
+            continue;
+        }
+        if (!valid_production(production, idx)) {
+            return {};
+        }
+        std::array<bool, k_token_type_count> first {};
+        add_first_tokens(production.rhs[0], first);
+        for (size_t token = 0; token < k_token_type_count; token++) {
+            if (!first[token]) {
+                continue;
+            }
+            if (table[token].rule != Rule::none) {
+                return {};
+            }
+            table[token].rule = production.rule;
+            table[token].lookahead = production.lookahead;
+            for (size_t pos = 0; pos < production.lookahead; pos++) {
+                table[token].prefix[pos] = production.rhs[pos].terminal ? production.rhs[pos].token : static_cast<TokenType>(token);
+            }
+        }
+    }
+    return table;
+}
+
+static_assert(dispatch_table(NonTerminal::stmt).has_value(), "Stmt is not LL(k) with the given lookaheads");
+static_assert(dispatch_table(NonTerminal::if_pred).has_value(), "IfPred is not LL(k) with the given lookaheads");
+
+inline constexpr std::array<RuleDispatch, k_token_type_count> k_stmt_dispatch = dispatch_table(NonTerminal::stmt).value();
+inline constexpr std::array<RuleDispatch, k_token_type_count> k_if_pred_dispatch = dispatch_table(NonTerminal::if_pred).value();
+
+// Precedence and node kind per token; a precedence of -1 marks a token that
+// is not a binary operator.
+inline constexpr std::array<BinaryOperator, k_token_type_count> k_bin_op_table = [] {
+    std::array<BinaryOperator, k_token_type_count> table {};
+    for (size_t token = 0; token < k_token_type_count; token++) {
+        table[token] = { static_cast<TokenType>(token), -1, NodeKind::add };
+    }
+    for (const BinaryOperator& op : k_binary_operators) {
+        table[static_cast<size_t>(op.token)] = op;
+    }
+    return table;
+}();
+
+inline std::optional<int> bin_prec(const TokenType type) {
+    const int prec = k_bin_op_table[static_cast<size_t>(type)].prec;
+    if (prec < 0) {
+        return {};
+    }
+    return prec;
+}
+
+inline NodeKind bin_expr_kind(const TokenType type) {
+    return k_bin_op_table[static_cast<size_t>(type)].kind;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "./ast.hpp"
+
+// Maps expression nodes (kind plus a/b fields) to the first node built with
+// the same contents, so the parser can hand out that node again instead of
+// building a copy. Children are compared by index, which makes equal indices
+// mean equal subtrees.
+//
+// Entries are scoped: release(mark) forgets everything added since mark().
+// The parser releases at the end of each scope, so a node is never shared
+// with code where its identifiers could be bound to other variables.
+class ExprTable {
+public:
+    ExprTable() : m_slots(k_initial_slots, Slot { NodeKind::int_lit, 0, 0, k_no_node }) {
+    }
+
+    [[nodiscard]] std::optional<NodeIndex> find(const NodeKind kind, const std::uint32_t a, const std::uint32_t b) const {
+        size_t slot = hash(kind, a, b) & (m_slots.size() - 1);
+        while (m_slots[slot].node != k_no_node) {
+            if (m_slots[slot].kind == kind && m_slots[slot].a == a && m_slots[slot].b == b) {
+                return m_slots[slot].node;
+            }
+            slot = (slot + 1) & (m_slots.size() - 1);
+        }
+        return {};
+    }
+
+    // `node` must not be in the table yet.
+    void insert(const NodeKind kind, const std::uint32_t a, const std::uint32_t b, const NodeIndex node) {
+        m_log.push_back(place({ kind, a, b, node }));
+        if (m_log.size() * 2 > m_slots.size()) {
+            grow();
+        }
+    }
+
+    [[nodiscard]] size_t mark() const {
+        return m_log.size();
+    }
+
+    void release(const size_t mark) {
+        // Entries go in the reverse order they came in. An entry's probe
+        // sequence only crosses slots that were taken before it, so emptying
+        // the newest slot never cuts off an older entry.
+        while (m_log.size() > mark) {
+            m_slots[m_log.back()].node = k_no_node;
+            m_log.pop_back();
+        }
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_log.size();
+    }
+
+private:
+    static constexpr size_t k_initial_slots = 1024;
+
+    struct Slot {
+        NodeKind kind;
+        std::uint32_t a;
+        std::uint32_t b;
+        NodeIndex node;
+    };
+
+    static std::uint64_t hash(const NodeKind kind, const std::uint32_t a, const std::uint32_t b) {
+        std::uint64_t hash = (static_cast<std::uint64_t>(a) << 32 | b) * 0x9E3779B97F4A7C15ull;
+        hash ^= static_cast<std::uint64_t>(kind) * 0xBF58476D1CE4E5B9ull;
+        return hash ^ (hash >> 31);
+    }
+
+    size_t place(const Slot& entry) {
+        size_t slot = hash(entry.kind, entry.a, entry.b) & (m_slots.size() - 1);
+        while (m_slots[slot].node != k_no_node) {
+            slot = (slot + 1) & (m_slots.size() - 1);
+        }
+        m_slots[slot] = entry;
+        return slot;
+    }
+
+    // Re-places the entries in the order they were added, which keeps the
+    // ordering release() relies on.
+    void grow() {
+        std::vector<Slot> old(m_slots.size() * 2, Slot { NodeKind::int_lit, 0, 0, k_no_node });
+        old.swap(m_slots);
+        for (size_t& slot : m_log) {
+            slot = place(old[slot]);
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    // Slot of each live entry, oldest first.
+    std::vector<size_t> m_log {};
+};
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./parser.hpp"
+#include "./symbols.hpp"
+#include "tokenization.hpp"
+
+// Replaces the `removed` bytes at `offset` with `inserted`.
+struct TextEdit {
+    size_t offset;
+    size_t removed;
+    std::string inserted;
+};
+
+// What the last edit cost.
+struct ReparseStats {
+    // From where lexing restarted to where the old statements took over.
+    size_t relexed_bytes;
+    size_t reparsed_stmts;
+    // Nesting depth of the statement list that was reparsed; 0 is the top
+    // level.
+    size_t depth;
+};
+
+// A program kept parsed across edits. apply() finds the innermost statement
+// list (the top level or a scope) that contains the edit, and re-lexes and
+// reparses only from the statement the edit is in up to the first old
+// statement boundary the new tokens line up with again. Every statement
+// outside that range keeps its nodes, at the same indices. An edit that
+// unbalances the braces of a scope is retried one level further out.
+//
+// The result is the AST a full parse of the edited source gives, up to the
+// order of the node arrays and the numbering of symbols, and a source with a
+// syntax error fails the same way. Hash-consing is not supported, as shared
+// nodes would tie statements together.
+class IncrementalDocument {
+public:
+    explicit IncrementalDocument(std::string source) : m_source(std::move(source)) {
+        check_size();
+        m_kinds.push_back(NodeKind::prog);
+        m_nodes.push_back({ 0, 0, 0 });
+        m_spans.push_back({ 0, 0, 0 });
+        reparse({ { root(), 0, 0, 0 } }, 0, TextEdit { 0, 0, {} });
+        m_compacted_size = m_kinds.size();
+    }
+
+    void apply(const TextEdit& edit) {
+        if (edit.offset > m_source.size() || edit.removed > m_source.size() - edit.offset) {
+            std::cerr << "Invalid edit" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const std::vector<Level> path = levels_containing(edit);
+        m_source.replace(edit.offset, edit.removed, edit.inserted);
+        check_size();
+        size_t depth = path.size() - 1;
+        while (!reparse(path, depth, edit)) {
+            depth--;
+        }
+        if (m_kinds.size() > 2 * m_compacted_size + k_min_compact_size) {
+            compact();
+        }
+    }
+
+    // Invalidated by apply().
+    [[nodiscard]] Ast ast() {
+        return { { m_kinds.data(), m_kinds.size() }, { m_nodes.data(), m_nodes.size() }, { m_lists.data(), m_lists.size() } };
+    }
+
+    // Invalidated the same way.
+    [[nodiscard]] SymbolNames names() const {
+        return m_symbols.names();
+    }
+
+    [[nodiscard]] const std::string& source() const {
+        return m_source;
+    }
+
+    [[nodiscard]] const ReparseStats& last_reparse() const {
+        return m_stats;
+    }
+
+private:
+    // Garbage left behind by edits is collected once the arrays have grown
+    // to twice their live size, plus this much.
+    static constexpr size_t k_min_compact_size = 4096;
+
+    // A statement list on the way from the top level to an edit.
+    struct Level {
+        // The scope, or the prog node.
+        NodeIndex scope;
+        // Its `{` and `}` (0 for the top level), before the edit.
+        std::uint32_t open;
+        std::uint32_t close;
+        // The statement in this list that contains the next level.
+        size_t containing;
+    };
+
+    [[nodiscard]] NodeIndex root() const {
+        return static_cast<NodeIndex>(m_kinds.size() - 1);
+    }
+
+    [[nodiscard]] ArenaSpan<const NodeIndex> stmts(const NodeIndex list) const {
+        return { m_lists.data() + m_nodes[list].a, m_nodes[list].b };
+    }
+
+    void check_size() const {
+        if (m_source.size() > UINT32_MAX) {
+            std::cerr << "Source file too large" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The first token of `stmt`, relative to its level.
+    [[nodiscard]] SourceSpan first_token(const NodeIndex stmt) const {
+        const SourceSpan span = m_spans[stmt];
+        return m_kinds[stmt] == NodeKind::scope ? SourceSpan { span.begin, span.begin + 1, span.begin } : span;
+    }
+
+    // Index of the last statement of `level` that starts before `offset`,
+    // or the list size if there is none.
+    [[nodiscard]] size_t stmt_before(const Level& level, const size_t offset) const {
+        const ArenaSpan<const NodeIndex> list = stmts(level.scope);
+        const auto it = std::partition_point(list.begin(), list.end(), [&](const NodeIndex stmt) {
+            return level.open + first_token(stmt).begin < offset;
+        });
+        return it == list.begin() ? list.size : static_cast<size_t>(it - list.begin() - 1);
+    }
+
+    // Calls `visit` on every scope directly inside statement `stmt`.
+    template <typename Visit>
+    void for_each_body(const NodeIndex stmt, Visit visit) const {
+        if (m_kinds[stmt] == NodeKind::scope) {
+            visit(stmt);
+            return;
+        }
+        if (m_kinds[stmt] != NodeKind::stmt_if) {
+            return;
+        }
+        visit(m_nodes[stmt].b);
+        for (NodeIndex pred = m_nodes[stmt].c; pred != k_no_node;) {
+            if (m_kinds[pred] == NodeKind::pred_else) {
+                visit(m_nodes[pred].a);
+                break;
+            }
+            visit(m_nodes[pred].b);
+            pred = m_nodes[pred].c;
+        }
+    }
+
+    // The top level, then every scope that contains the edit without
+    // touching its braces, outermost first.
+    [[nodiscard]] std::vector<Level> levels_containing(const TextEdit& edit) const {
+        std::vector<Level> path { { root(), 0, 0, 0 } };
+        const size_t edit_end = edit.offset + edit.removed;
+        while (edit.offset > 0) {
+            Level& level = path.back();
+            const size_t idx = stmt_before(level, edit.offset);
+            if (idx == stmts(level.scope).size) {
+                break;
+            }
+            std::optional<Level> inner;
+            for_each_body(stmts(level.scope)[idx], [&](const NodeIndex scope) {
+                const std::uint32_t open = level.open + m_spans[scope].begin;
+                const std::uint32_t close = level.open + m_spans[scope].end;
+                if (open < edit.offset && edit_end <= close) {
+                    inner = Level { scope, open, close, 0 };
+                }
+            });
+            if (!inner.has_value()) {
+                break;
+            }
+            level.containing = idx;
+            path.push_back(inner.value());
+        }
+        return path;
+    }
+
+    // Reparses the affected statements of path[depth], which the edit has
+    // already been applied to the source for. Returns false, changing
+    // nothing, if the edit moved the end of that scope.
+    bool reparse(const std::vector<Level>& path, const size_t depth, const TextEdit& edit) {
+        const Level& level = path[depth];
+        const bool top = depth == 0;
+        const std::vector<NodeIndex> old(stmts(level.scope).begin(), stmts(level.scope).end());
+        const auto begin_of = [&](const size_t idx) {
+            return static_cast<size_t>(level.open + first_token(old[idx]).begin);
+        };
+        const auto delta = static_cast<std::ptrdiff_t>(edit.inserted.size()) - static_cast<std::ptrdiff_t>(edit.removed);
+        const size_t old_edit_end = edit.offset + edit.removed;
+        const size_t new_edit_end = edit.offset + edit.inserted.size();
+
+        // The statement the edit starts in; the one before it as well if the
+        // edit reaches into its first token, which that one may have looked
+        // at to see whether an if chain goes on.
+        size_t first = edit.offset == 0 ? old.size() : stmt_before(level, edit.offset);
+        if (first < old.size() && edit.offset <= level.open + first_token(old[first]).end) {
+            first = first == 0 ? old.size() : first - 1;
+        }
+        if (first == old.size()) {
+            first = 0;
+        }
+        // Lexing starts at the token before the first reparsed statement,
+        // for diagnostics (see Parser::skip_token()). There is none before
+        // the first statement of the program.
+        std::optional<size_t> before;
+        if (first > 0) {
+            before = level.open + m_spans[old[first - 1]].last;
+        }
+        else if (!top) {
+            before = level.open;
+        }
+        const size_t start = before.value_or(0);
+
+        const std::string_view source = m_source;
+        Parser parser(TokenStream(source, Tokenizer(source.substr(start), m_symbols)));
+        parser.track_spans();
+        if (before.has_value()) {
+            parser.skip_token();
+        }
+        size_t candidate = first;
+        size_t resume = old.size();
+        size_t end = source.size();
+        std::vector<NodeIndex> roots;
+        while (true) {
+            const std::optional<std::uint32_t> next = parser.next_offset();
+            // Past the edit, the tokens are the old ones, so the old
+            // statements take over from the first boundary both agree on.
+            if (next.has_value() && next.value() >= new_edit_end) {
+                const size_t old_offset = static_cast<size_t>(static_cast<std::ptrdiff_t>(next.value()) - delta);
+                if (!top && old_offset > level.close) {
+                    return false;
+                }
+                while (candidate < old.size() && begin_of(candidate) < old_offset) {
+                    candidate++;
+                }
+                if (candidate < old.size() && begin_of(candidate) == old_offset) {
+                    resume = candidate;
+                    end = next.value();
+                    break;
+                }
+            }
+            const NodeIndex stmt = parser.parse_next_stmt(!top);
+            if (stmt == k_no_node) {
+                // The end of the input, or a `}` that has to be the old one.
+                if (!top
+                    && (next.value() < new_edit_end
+                        || static_cast<size_t>(static_cast<std::ptrdiff_t>(next.value()) - delta) != level.close)) {
+                    return false;
+                }
+                end = next.value_or(source.size());
+                break;
+            }
+            roots.push_back(stmt);
+        }
+
+        // Everything after the edit moves by `delta`: the statements kept in
+        // this list and, in every enclosing list, the rest of the statement
+        // the edit is in plus all statements after it.
+        for (size_t idx = resume; idx < old.size(); idx++) {
+            shift_stmt(old[idx], old_edit_end - level.open, delta);
+        }
+        for (size_t outer = depth; outer-- > 0;) {
+            const ArenaSpan<const NodeIndex> list = stmts(path[outer].scope);
+            for (size_t idx = path[outer].containing; idx < list.size; idx++) {
+                shift_stmt(list[idx], old_edit_end - path[outer].open, delta);
+            }
+        }
+
+        const AstNode prog = m_nodes[root()];
+        const Ast piece = parser.finish_nodes();
+        const ArenaSpan<SourceSpan> spans = parser.finish_spans();
+        const auto node_base = static_cast<std::uint32_t>(m_kinds.size());
+        const auto list_base = static_cast<std::uint32_t>(m_lists.size());
+        for (size_t idx = 0; idx < piece.kinds.size; idx++) {
+            m_kinds.push_back(piece.kinds[idx]);
+            m_nodes.push_back(relocate_node(piece.kinds[idx], piece.nodes[idx], node_base, list_base));
+            m_spans.push_back(spans[idx]);
+        }
+        for (const NodeIndex stmt : piece.lists) {
+            m_lists.push_back(stmt + node_base);
+        }
+        for (NodeIndex& stmt : roots) {
+            stmt += node_base;
+        }
+        make_relative(roots, level.open);
+
+        const auto list_start = static_cast<std::uint32_t>(m_lists.size());
+        m_lists.insert(m_lists.end(), old.begin(), old.begin() + static_cast<std::ptrdiff_t>(first));
+        m_lists.insert(m_lists.end(), roots.begin(), roots.end());
+        m_lists.insert(m_lists.end(), old.begin() + static_cast<std::ptrdiff_t>(resume), old.end());
+        const auto list_size = static_cast<std::uint32_t>(m_lists.size() - list_start);
+        if (!top) {
+            m_nodes[level.scope].a = list_start;
+            m_nodes[level.scope].b = list_size;
+        }
+        // The prog node has to stay last, after the new nodes.
+        m_kinds.push_back(NodeKind::prog);
+        m_nodes.push_back(top ? AstNode { list_start, list_size, 0 } : prog);
+        m_spans.push_back({ 0, 0, 0 });
+        m_stats = { end - start, roots.size(), depth };
+        return true;
+    }
+
+    // Moves the parts of `stmt` (relative to its level) at or after
+    // `threshold` by `delta`. A statement or scope that contains the
+    // threshold only has its end moved.
+    void shift_stmt(const NodeIndex stmt, const size_t threshold, const std::ptrdiff_t delta) {
+        const auto shift = [&](const NodeIndex node) {
+            SourceSpan& span = m_spans[node];
+            if (span.begin >= threshold) {
+                span.begin = static_cast<std::uint32_t>(span.begin + delta);
+                span.end = static_cast<std::uint32_t>(span.end + delta);
+            }
+            else if (m_kinds[node] == NodeKind::scope && span.end >= threshold) {
+                span.end = static_cast<std::uint32_t>(span.end + delta);
+            }
+            if (span.last >= threshold) {
+                span.last = static_cast<std::uint32_t>(span.last + delta);
+            }
+        };
+        if (m_kinds[stmt] != NodeKind::scope) {
+            shift(stmt);
+        }
+        for_each_body(stmt, shift);
+    }
+
+    // The parser records absolute offsets; the document keeps them relative
+    // to the `{` of the enclosing scope, so that an edit only moves what
+    // follows it on its own path. `stmts` are new statements of the level
+    // whose `{` is at `open`.
+    void make_relative(const std::vector<NodeIndex>& stmts, const std::uint32_t open) {
+        struct Pending {
+            NodeIndex stmt;
+            std::uint32_t open;
+        };
+        std::vector<Pending> pending;
+        for (const NodeIndex stmt : stmts) {
+            pending.push_back({ stmt, open });
+        }
+        while (!pending.empty()) {
+            const Pending item = pending.back();
+            pending.pop_back();
+            const auto relative = [&](const NodeIndex node) {
+                for (const NodeIndex inner : this->stmts(node)) {
+                    pending.push_back({ inner, m_spans[node].begin });
+                }
+                make_relative(m_spans[node], item.open);
+            };
+            if (m_kinds[item.stmt] != NodeKind::scope) {
+                make_relative(m_spans[item.stmt], item.open);
+            }
+            for_each_body(item.stmt, relative);
+        }
+    }
+
+    static void make_relative(SourceSpan& span, const std::uint32_t open) {
+        span.begin -= open;
+        span.end -= open;
+        span.last -= open;
+    }
+
+    // Copies the live nodes into fresh arrays, children before parents and
+    // in source order, which is the layout a full parse produces.
+    void compact() {
+        std::vector<NodeKind> kinds;
+        std::vector<AstNode> nodes;
+        std::vector<NodeIndex> lists;
+        std::vector<SourceSpan> spans;
+        std::vector<NodeIndex> remap(m_kinds.size(), k_no_node);
+        struct Visit {
+            NodeIndex node;
+            bool children_done;
+        };
+        std::vector<Visit> visits { { root(), false } };
+        while (!visits.empty()) {
+            const Visit visit = visits.back();
+            visits.pop_back();
+            const NodeKind kind = m_kinds[visit.node];
+            AstNode node = m_nodes[visit.node];
+            const bool has_list = kind == NodeKind::scope || kind == NodeKind::prog;
+            if (!visit.children_done) {
+                visits.push_back({ visit.node, true });
+                if (has_list) {
+                    const ArenaSpan<const NodeIndex> list = stmts(visit.node);
+                    for (size_t idx = list.size; idx > 0; idx--) {
+                        visits.push_back({ list[idx - 1], false });
+                    }
+                    continue;
+                }
+                // Last to first, so that a comes out first.
+                std::vector<NodeIndex> children;
+                static_cast<void>(map_children(kind, node, [&](const NodeIndex child) {
+                    children.push_back(child);
+                    return child;
+                }));
+                for (size_t idx = children.size(); idx > 0; idx--) {
+                    visits.push_back({ children[idx - 1], false });
+                }
+                continue;
+            }
+            if (has_list) {
+                const auto first = static_cast<std::uint32_t>(lists.size());
+                for (const NodeIndex stmt : stmts(visit.node)) {
+                    lists.push_back(remap[stmt]);
+                }
+                node.a = first;
+            }
+            else {
+                node = map_children(kind, node, [&](const NodeIndex child) {
+                    return remap[child];
+                });
+            }
+            remap[visit.node] = static_cast<NodeIndex>(kinds.size());
+            kinds.push_back(kind);
+            nodes.push_back(node);
+            spans.push_back(m_spans[visit.node]);
+        }
+        m_kinds = std::move(kinds);
+        m_nodes = std::move(nodes);
+        m_lists = std::move(lists);
+        m_spans = std::move(spans);
+        m_compacted_size = m_kinds.size();
+    }
+
+    std::string m_source;
+    SymbolTable m_symbols;
+    std::vector<NodeKind> m_kinds {};
+    std::vector<AstNode> m_nodes {};
+    std::vector<NodeIndex> m_lists {};
+    // Parallel to the nodes, for statements and scopes. Offsets are relative
+    // to the `{` of the enclosing scope (to the start of the source at the
+    // top level), so an edit only moves the spans after it on each level of
+    // the path to it, not all later ones.
+    std::vector<SourceSpan> m_spans {};
+    size_t m_compacted_size = 0;
+    ReparseStats m_stats {};
+};
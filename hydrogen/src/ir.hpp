@@ -0,0 +1,641 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using ValueId = std::uint32_t;
+using BlockId = std::uint32_t;
+
+inline constexpr BlockId k_no_block = UINT32_MAX;
+
+// One byte per instruction. The comments give the meaning of its a/b/c
+// fields. An instruction that produces a value is that value, so a ValueId
+// is an instruction index.
+enum class IrOp : std::uint8_t {
+    // a, b: low and high 32 bits of the value.
+    const_,
+    // a, b: operands. Arithmetic wraps around at 64 bits, and div is
+    // unsigned.
+    add,
+    sub,
+    mul,
+    div,
+    // a: first incoming value in Ir::phi_args, b: their count, one per
+    // predecessor. Only at the start of a block.
+    phi,
+    // Terminators, one at the end of every block and nowhere else.
+    // a: target.
+    jump,
+    // a: condition, b: target when it is not zero, c: target when it is.
+    branch,
+    // a: exit code.
+    exit,
+};
+
+struct IrInst {
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t c;
+};
+
+// `value` is what the phi takes when control comes from `block`.
+struct PhiArg {
+    BlockId block;
+    ValueId value;
+};
+
+// The instructions [first, end).
+struct IrBlock {
+    std::uint32_t first;
+    std::uint32_t end;
+};
+
+inline bool is_terminator(const IrOp op) {
+    return op >= IrOp::jump;
+}
+
+inline bool has_value(const IrOp op) {
+    return op <= IrOp::phi;
+}
+
+inline bool is_bin_op(const IrOp op) {
+    return op >= IrOp::add && op <= IrOp::div;
+}
+
+// The value of `lhs op rhs` for a binary op, as the generated code computes
+// it: modulo 2^64, with unsigned division. Division by zero has no value, as
+// it stops the program.
+inline std::optional<std::uint64_t> fold_bin_op(const IrOp op, const std::uint64_t lhs, const std::uint64_t rhs) {
+    switch (op) {
+        case IrOp::add:
+            return lhs + rhs;
+        case IrOp::sub:
+            return lhs - rhs;
+        case IrOp::mul:
+            return lhs * rhs;
+        case IrOp::div:
+            if (rhs == 0) {
+                return {};
+            }
+            return lhs / rhs;
+        default:
+            assert(false); // Unreachable;
+            return {};
+    }
+}
+
+// The whole program as one function in SSA form: a control-flow graph of
+// basic blocks, entered at block 0. The blocks hold consecutive runs of the
+// instruction arrays, in block order, so walking the instructions in index
+// order walks the blocks in order too. Every value is defined once, and its
+// definition dominates its uses.
+struct Ir {
+    std::vector<IrOp> ops;
+    std::vector<IrInst> insts;
+    std::vector<PhiArg> phi_args;
+    std::vector<IrBlock> blocks;
+    // The predecessors of block `b` are preds[pred_begin[b]] up to
+    // preds[pred_begin[b + 1]]. Derived from the terminators; see
+    // compute_preds().
+    std::vector<BlockId> preds;
+    std::vector<std::uint32_t> pred_begin;
+
+    [[nodiscard]] std::uint64_t const_value(const ValueId value) const {
+        return insts[value].a | static_cast<std::uint64_t>(insts[value].b) << 32;
+    }
+
+    [[nodiscard]] IrOp terminator(const BlockId block) const {
+        return ops[blocks[block].end - 1];
+    }
+
+    // Calls `visit` with each block control can go to from `block`.
+    template <typename Visit>
+    void for_each_succ(const BlockId block, Visit visit) const {
+        const IrInst& inst = insts[blocks[block].end - 1];
+        switch (terminator(block)) {
+            case IrOp::jump:
+                visit(inst.a);
+                break;
+            case IrOp::branch:
+                visit(inst.b);
+                visit(inst.c);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Calls `visit` with each value `inst` uses, phi arguments included.
+    template <typename Visit>
+    void for_each_operand(const ValueId inst, Visit visit) const {
+        const IrInst& fields = insts[inst];
+        switch (ops[inst]) {
+            case IrOp::add:
+            case IrOp::sub:
+            case IrOp::mul:
+            case IrOp::div:
+                visit(fields.a);
+                visit(fields.b);
+                break;
+            case IrOp::phi:
+                for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                    visit(phi_args[idx].value);
+                }
+                break;
+            case IrOp::branch:
+            case IrOp::exit:
+                visit(fields.a);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void compute_preds() {
+        pred_begin.assign(blocks.size() + 1, 0);
+        for (BlockId block = 0; block < blocks.size(); block++) {
+            for_each_succ(block, [&](const BlockId succ) {
+                pred_begin[succ + 1]++;
+            });
+        }
+        for (size_t idx = 1; idx < pred_begin.size(); idx++) {
+            pred_begin[idx] += pred_begin[idx - 1];
+        }
+        preds.resize(pred_begin.back());
+        std::vector<std::uint32_t> next(pred_begin.begin(), pred_begin.end() - 1);
+        for (BlockId block = 0; block < blocks.size(); block++) {
+            for_each_succ(block, [&](const BlockId succ) {
+                preds[next[succ]++] = block;
+            });
+        }
+    }
+};
+
+// Removes instructions and blocks from an Ir and redirects the uses of
+// removed values, all at once in commit(), which renumbers what is left.
+// Changes that keep the shape of the arrays (turning an add into a const, a
+// branch into a jump) are made on the Ir directly, before committing.
+//
+// commit() also drops blocks that are no longer reachable, and phi
+// arguments for edges that no longer exist.
+class IrEditor {
+public:
+    explicit IrEditor(Ir& ir)
+        : m_ir(ir)
+        , m_removed(ir.insts.size(), false)
+        , m_replacements(ir.insts.size(), k_no_value)
+        , m_merged(ir.blocks.size(), false) {
+    }
+
+    // Uses of `value` become uses of `with`, and `value` goes.
+    void replace(const ValueId value, const ValueId with) {
+        m_replacements[value] = with;
+        m_removed[value] = true;
+    }
+
+    // `inst` must have no uses left.
+    void remove(const ValueId inst) {
+        m_removed[inst] = true;
+    }
+
+    // What uses of `value` will be uses of once committed.
+    [[nodiscard]] ValueId current(ValueId value) const {
+        while (m_replacements[value] != k_no_value) {
+            value = m_replacements[value];
+        }
+        return value;
+    }
+
+    // Appends `block` to the block before it, which has to be its only
+    // predecessor and end in a jump to it. That jump has to be removed, and
+    // so do the phis of `block`.
+    void merge_into_prev(const BlockId block) {
+        m_merged[block] = true;
+    }
+
+    void commit() {
+        const size_t block_count = m_ir.blocks.size();
+        std::vector<bool> reachable(block_count, false);
+        std::vector<BlockId> work { 0 };
+        reachable[0] = true;
+        while (!work.empty()) {
+            const BlockId block = work.back();
+            work.pop_back();
+            m_ir.for_each_succ(block, [&](const BlockId succ) {
+                if (!reachable[succ]) {
+                    reachable[succ] = true;
+                    work.push_back(succ);
+                }
+            });
+        }
+
+        std::vector<BlockId> block_map(block_count, k_no_block);
+        std::uint32_t next = 0;
+        for (BlockId block = 0; block < block_count; block++) {
+            if (reachable[block]) {
+                block_map[block] = m_merged[block] ? next - 1 : next++;
+            }
+        }
+        std::vector<ValueId> inst_map(m_ir.insts.size(), k_no_value);
+        next = 0;
+        for (BlockId block = 0; block < block_count; block++) {
+            for (ValueId inst = m_ir.blocks[block].first; reachable[block] && inst < m_ir.blocks[block].end; inst++) {
+                if (!m_removed[inst]) {
+                    inst_map[inst] = next++;
+                }
+            }
+        }
+        const auto value_of = [&](const ValueId value) {
+            const ValueId mapped = inst_map[current(value)];
+            assert(mapped != k_no_value);
+            return mapped;
+        };
+
+        Ir out;
+        out.ops.reserve(next);
+        out.insts.reserve(next);
+        for (BlockId block = 0; block < block_count; block++) {
+            if (!reachable[block]) {
+                continue;
+            }
+            if (!m_merged[block]) {
+                const auto first = static_cast<std::uint32_t>(out.insts.size());
+                out.blocks.push_back({ first, first });
+            }
+            for (ValueId inst = m_ir.blocks[block].first; inst < m_ir.blocks[block].end; inst++) {
+                if (m_removed[inst]) {
+                    continue;
+                }
+                IrInst fields = m_ir.insts[inst];
+                switch (m_ir.ops[inst]) {
+                    case IrOp::const_:
+                        break;
+                    case IrOp::add:
+                    case IrOp::sub:
+                    case IrOp::mul:
+                    case IrOp::div:
+                        fields = { value_of(fields.a), value_of(fields.b), 0 };
+                        break;
+                    case IrOp::phi: {
+                        const auto first_arg = static_cast<std::uint32_t>(out.phi_args.size());
+                        for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                            const PhiArg& arg = m_ir.phi_args[idx];
+                            if (reachable[arg.block] && is_succ(arg.block, block)) {
+                                out.phi_args.push_back({ block_map[arg.block], value_of(arg.value) });
+                            }
+                        }
+                        fields = { first_arg, static_cast<std::uint32_t>(out.phi_args.size()) - first_arg, 0 };
+                        break;
+                    }
+                    case IrOp::jump:
+                        fields.a = block_map[fields.a];
+                        break;
+                    case IrOp::branch:
+                        fields = { value_of(fields.a), block_map[fields.b], block_map[fields.c] };
+                        break;
+                    case IrOp::exit:
+                        fields.a = value_of(fields.a);
+                        break;
+                }
+                out.ops.push_back(m_ir.ops[inst]);
+                out.insts.push_back(fields);
+            }
+            out.blocks.back().end = static_cast<std::uint32_t>(out.insts.size());
+        }
+        out.compute_preds();
+        m_ir = std::move(out);
+    }
+
+private:
+    static constexpr ValueId k_no_value = UINT32_MAX;
+
+    [[nodiscard]] bool is_succ(const BlockId block, const BlockId succ) const {
+        bool found = false;
+        m_ir.for_each_succ(block, [&](const BlockId target) {
+            found = found || target == succ;
+        });
+        return found;
+    }
+
+    Ir& m_ir;
+    std::vector<bool> m_removed;
+    std::vector<ValueId> m_replacements;
+    std::vector<bool> m_merged;
+};
+
+// Textual form, for --emit-ir:
+//
+//     block2: ; preds block0, block1
+//         %7 = phi [block0 %3], [block1 %6]
+//         %8 = const 2
+//         %9 = div %7, %8
+//         exit %9
+class IrPrinter {
+public:
+    IrPrinter(const Ir& ir, std::ostream& output) : m_ir(ir), m_output(output) {
+    }
+
+    void print() {
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            m_output << "block" << block << ":";
+            const std::uint32_t begin = m_ir.pred_begin[block];
+            const std::uint32_t end = m_ir.pred_begin[block + 1];
+            for (std::uint32_t idx = begin; idx < end; idx++) {
+                m_output << (idx == begin ? " ; preds block" : ", block") << m_ir.preds[idx];
+            }
+            m_output << "\n";
+            for (ValueId inst = m_ir.blocks[block].first; inst < m_ir.blocks[block].end; inst++) {
+                print_inst(inst);
+            }
+        }
+    }
+
+private:
+    void print_inst(const ValueId inst) {
+        const IrInst& fields = m_ir.insts[inst];
+        const IrOp op = m_ir.ops[inst];
+        m_output << "    ";
+        if (has_value(op)) {
+            m_output << "%" << inst << " = ";
+        }
+        m_output << k_op_names[static_cast<size_t>(op)];
+        switch (op) {
+            case IrOp::const_:
+                m_output << " " << m_ir.const_value(inst);
+                break;
+            case IrOp::add:
+            case IrOp::sub:
+            case IrOp::mul:
+            case IrOp::div:
+                m_output << " %" << fields.a << ", %" << fields.b;
+                break;
+            case IrOp::phi:
+                for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                    const PhiArg& arg = m_ir.phi_args[idx];
+                    m_output << (idx == fields.a ? " [block" : ", [block") << arg.block << " %" << arg.value << "]";
+                }
+                break;
+            case IrOp::jump:
+                m_output << " block" << fields.a;
+                break;
+            case IrOp::branch:
+                m_output << " %" << fields.a << ", block" << fields.b << ", block" << fields.c;
+                break;
+            case IrOp::exit:
+                m_output << " %" << fields.a;
+                break;
+        }
+        m_output << "\n";
+    }
+
+    // Indexed by IrOp.
+    static constexpr const char* k_op_names[] = { "const", "add", "sub", "mul", "div", "phi", "jump", "branch", "exit" };
+
+    const Ir& m_ir;
+    std::ostream& m_output;
+};
+
+// Checks the invariants the rest of the compiler relies on, and stops with
+// a diagnostic at the first one that does not hold. A failure is a bug in
+// whatever produced the IR, not in the program being compiled.
+class IrVerifier {
+public:
+    explicit IrVerifier(const Ir& ir) : m_ir(ir) {
+    }
+
+    void verify() {
+        check_layout();
+        check_blocks();
+        compute_dominators();
+        check_dominance();
+    }
+
+private:
+    // Blocks are non-empty, in order, and together hold every instruction.
+    void check_layout() {
+        if (m_ir.blocks.empty()) {
+            fail(0, "the program has no blocks");
+        }
+        if (m_ir.ops.size() != m_ir.insts.size()) {
+            fail(0, "ops and insts differ in size");
+        }
+        if (m_ir.pred_begin.size() != m_ir.blocks.size() + 1) {
+            fail(0, "predecessors not computed");
+        }
+        std::uint32_t next = 0;
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            if (m_ir.blocks[block].first != next || m_ir.blocks[block].end <= next) {
+                fail(block, "block is empty or out of order");
+            }
+            next = m_ir.blocks[block].end;
+        }
+        if (next != m_ir.insts.size()) {
+            fail(0, "instructions after the last block");
+        }
+    }
+
+    void check_blocks() {
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            const IrBlock& range = m_ir.blocks[block];
+            bool phis_done = false;
+            for (ValueId inst = range.first; inst < range.end; inst++) {
+                const IrOp op = m_ir.ops[inst];
+                if (is_terminator(op) != (inst + 1 == range.end)) {
+                    fail(block, "terminator missing or not last");
+                }
+                if (op == IrOp::phi) {
+                    if (phis_done) {
+                        fail(block, "phi after other instructions");
+                    }
+                    check_phi(block, inst);
+                }
+                else {
+                    phis_done = true;
+                }
+                m_ir.for_each_operand(inst, [&](const ValueId value) {
+                    if (value >= m_ir.insts.size() || !has_value(m_ir.ops[value])) {
+                        fail(block, "operand is not a value");
+                    }
+                });
+            }
+            const IrInst& last = m_ir.insts[range.end - 1];
+            m_ir.for_each_succ(block, [&](const BlockId succ) {
+                if (succ >= m_ir.blocks.size() || succ == 0) {
+                    fail(block, "jump to a missing block or to the entry");
+                }
+            });
+            if (m_ir.terminator(block) == IrOp::branch && last.b == last.c) {
+                fail(block, "branch with the same block on both sides");
+            }
+        }
+    }
+
+    // One argument per predecessor.
+    void check_phi(const BlockId block, const ValueId phi) {
+        const IrInst& fields = m_ir.insts[phi];
+        const std::uint32_t begin = m_ir.pred_begin[block];
+        const std::uint32_t count = m_ir.pred_begin[block + 1] - begin;
+        if (fields.b != count || fields.a + fields.b > m_ir.phi_args.size()) {
+            fail(block, "phi argument count differs from predecessor count");
+        }
+        for (std::uint32_t idx = 0; idx < count; idx++) {
+            const BlockId pred = m_ir.phi_args[fields.a + idx].block;
+            bool found = false;
+            for (std::uint32_t other = 0; other < count; other++) {
+                found = found || m_ir.preds[begin + other] == pred;
+            }
+            for (std::uint32_t other = 0; other < idx; other++) {
+                found = found && m_ir.phi_args[fields.a + other].block != pred;
+            }
+            if (!found) {
+                fail(block, "phi argument for a block that is not a predecessor");
+            }
+        }
+    }
+
+    // Immediate dominators by the Cooper-Harvey-Kennedy iteration over
+    // reverse postorder, then pre/post numbers of the dominator tree, so
+    // that dominance is an O(1) interval check.
+    void compute_dominators() {
+        const size_t count = m_ir.blocks.size();
+        m_rpo_index.assign(count, UINT32_MAX);
+        std::vector<BlockId> postorder;
+        std::vector<std::pair<BlockId, bool>> stack { { 0, false } };
+        std::vector<bool> seen(count, false);
+        while (!stack.empty()) {
+            const auto [block, done] = stack.back();
+            stack.pop_back();
+            if (done) {
+                postorder.push_back(block);
+                continue;
+            }
+            if (seen[block]) {
+                continue;
+            }
+            seen[block] = true;
+            stack.push_back({ block, true });
+            m_ir.for_each_succ(block, [&](const BlockId succ) {
+                if (!seen[succ]) {
+                    stack.push_back({ succ, false });
+                }
+            });
+        }
+        if (postorder.size() != count) {
+            for (BlockId block = 0; block < count; block++) {
+                if (!seen[block]) {
+                    fail(block, "unreachable block");
+                }
+            }
+        }
+        const std::vector<BlockId> rpo(postorder.rbegin(), postorder.rend());
+        for (std::uint32_t idx = 0; idx < count; idx++) {
+            m_rpo_index[rpo[idx]] = idx;
+        }
+        m_idom.assign(count, k_no_block);
+        m_idom[0] = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t idx = 1; idx < count; idx++) {
+                const BlockId block = rpo[idx];
+                BlockId idom = k_no_block;
+                for (std::uint32_t pred = m_ir.pred_begin[block]; pred < m_ir.pred_begin[block + 1]; pred++) {
+                    const BlockId from = m_ir.preds[pred];
+                    if (m_idom[from] != k_no_block) {
+                        idom = idom == k_no_block ? from : intersect(from, idom);
+                    }
+                }
+                if (m_idom[block] != idom) {
+                    m_idom[block] = idom;
+                    changed = true;
+                }
+            }
+        }
+
+        std::vector<std::vector<BlockId>> children(count);
+        for (BlockId block = 1; block < count; block++) {
+            children[m_idom[block]].push_back(block);
+        }
+        m_pre.assign(count, 0);
+        m_post.assign(count, 0);
+        std::uint32_t clock = 0;
+        stack = { { 0, false } };
+        while (!stack.empty()) {
+            const auto [block, done] = stack.back();
+            stack.pop_back();
+            if (done) {
+                m_post[block] = clock++;
+                continue;
+            }
+            m_pre[block] = clock++;
+            stack.push_back({ block, true });
+            for (const BlockId child : children[block]) {
+                stack.push_back({ child, false });
+            }
+        }
+    }
+
+    [[nodiscard]] BlockId intersect(BlockId lhs, BlockId rhs) const {
+        while (lhs != rhs) {
+            while (m_rpo_index[lhs] > m_rpo_index[rhs]) {
+                lhs = m_idom[lhs];
+            }
+            while (m_rpo_index[rhs] > m_rpo_index[lhs]) {
+                rhs = m_idom[rhs];
+            }
+        }
+        return lhs;
+    }
+
+    [[nodiscard]] bool dominates(const BlockId lhs, const BlockId rhs) const {
+        return m_pre[lhs] <= m_pre[rhs] && m_post[rhs] <= m_post[lhs];
+    }
+
+    // A value is defined before its uses in its own block, in a block that
+    // dominates theirs otherwise. A phi uses its argument at the end of the
+    // predecessor it comes from.
+    void check_dominance() {
+        std::vector<BlockId> block_of(m_ir.insts.size());
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            for (ValueId inst = m_ir.blocks[block].first; inst < m_ir.blocks[block].end; inst++) {
+                block_of[inst] = block;
+            }
+        }
+        for (ValueId inst = 0; inst < m_ir.insts.size(); inst++) {
+            const BlockId block = block_of[inst];
+            if (m_ir.ops[inst] == IrOp::phi) {
+                const IrInst& fields = m_ir.insts[inst];
+                for (std::uint32_t idx = fields.a; idx < fields.a + fields.b; idx++) {
+                    const PhiArg& arg = m_ir.phi_args[idx];
+                    if (!dominates(block_of[arg.value], arg.block)) {
+                        fail(block, "phi argument not available in its predecessor");
+                    }
+                }
+                continue;
+            }
+            m_ir.for_each_operand(inst, [&](const ValueId value) {
+                const BlockId def = block_of[value];
+                if (def == block ? value >= inst : !dominates(def, block)) {
+                    fail(block, "use not dominated by its definition");
+                }
+            });
+        }
+    }
+
+    [[noreturn]] static void fail(const BlockId block, const std::string& message) {
+        std::cerr << "Invalid IR in block" << block << ": " << message << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const Ir& m_ir;
+    std::vector<std::uint32_t> m_rpo_index {};
+    std::vector<BlockId> m_idom {};
+    std::vector<std::uint32_t> m_pre {};
+    std::vector<std::uint32_t> m_post {};
+};
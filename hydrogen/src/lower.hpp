@@ -0,0 +1,383 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./ir.hpp"
+
+// Turns a resolved AST (see Resolver) into SSA form. Variables never reach
+// the IR: each slot's current value is tracked while lowering, and where
+// control flow joins after an if chain, a phi picks between the values a
+// slot has on the incoming edges. The language has no loops, so every
+// predecessor of a join is lowered before the join itself and its phis can
+// be completed on the spot.
+//
+// Assignments made inside an if chain are recorded in an undo log, so that
+// each arm starts from the values the chain began with, and the join only
+// looks at the slots some arm assigned. Lowering an if chain therefore costs
+// its size plus its assignments, not the number of live variables.
+//
+// Arithmetic is emitted as written, even on constants; folding it is left to
+// the const-fold pass, so -O0 output follows the source.
+//
+// Code after an exit is unreachable, and is left out, as is an if chain that
+// no arm leaves.
+class Lowerer {
+public:
+    explicit Lowerer(const Ast& ast) : m_ast(ast) {
+    }
+
+    [[nodiscard]] Ir lower() {
+        start_block();
+        push_stmts(m_ast.root());
+        while (!m_tasks.empty()) {
+            const Task task = m_tasks.back();
+            m_tasks.pop_back();
+            switch (task.kind) {
+                case TaskKind::stmt:
+                    lower_stmt(task.node);
+                    break;
+                case TaskKind::if_pred:
+                    lower_if_pred(task.node);
+                    break;
+                case TaskKind::end_scope:
+                    m_vars.resize(m_scopes.back());
+                    m_scopes.pop_back();
+                    break;
+                case TaskKind::end_arm:
+                    end_arm();
+                    break;
+                case TaskKind::end_chain:
+                    end_chain();
+                    break;
+            }
+        }
+        if (m_block != k_no_block) {
+            terminate(IrOp::exit, emit_const(0), 0, 0);
+        }
+        m_ir.compute_preds();
+        return std::move(m_ir);
+    }
+
+private:
+    void lower_stmt(const NodeIndex stmt) {
+        if (m_block == k_no_block) {
+            return;
+        }
+        const AstNode& node = m_ast.node(stmt);
+        switch (m_ast.kind(stmt)) {
+            case NodeKind::stmt_exit:
+                terminate(IrOp::exit, lower_expr(node.a), 0, 0);
+                break;
+            case NodeKind::stmt_let: {
+                const ValueId value = lower_expr(node.b);
+                m_vars.push_back(value);
+                break;
+            }
+            case NodeKind::stmt_assign:
+                assign(node.c, lower_expr(node.b));
+                break;
+            case NodeKind::scope:
+                push_scope(stmt);
+                break;
+            case NodeKind::stmt_if: {
+                const ValueId cond = lower_expr(node.a);
+                m_chains.push_back({ m_vars.size(), m_log.size(), m_exits.size(), m_edits.size(), k_no_block, 0 });
+                branch(cond);
+                m_tasks.push_back({ TaskKind::end_chain, stmt });
+                if (node.c != k_no_node) {
+                    m_tasks.push_back({ TaskKind::if_pred, node.c });
+                }
+                m_tasks.push_back({ TaskKind::end_arm, stmt });
+                push_scope(node.b);
+                break;
+            }
+            default:
+                assert(false); // Unreachable;
+        }
+    }
+
+    // Continues at the previous condition's zero target.
+    void lower_if_pred(const NodeIndex pred) {
+        Chain& chain = m_chains.back();
+        start_block();
+        m_ir.insts[chain.branch].c = m_block;
+        chain.branch_block = k_no_block;
+        const AstNode& node = m_ast.node(pred);
+        if (m_ast.kind(pred) == NodeKind::pred_elif) {
+            branch(lower_expr(node.a));
+            if (node.c != k_no_node) {
+                m_tasks.push_back({ TaskKind::if_pred, node.c });
+            }
+            m_tasks.push_back({ TaskKind::end_arm, pred });
+            push_scope(node.b);
+        }
+        else {
+            m_tasks.push_back({ TaskKind::end_arm, pred });
+            push_scope(node.a);
+        }
+    }
+
+    // Ends the current block on a branch on `cond`, and continues at its
+    // nonzero target. The zero target is filled in by the next elif or
+    // else, or by the join.
+    void branch(const ValueId cond) {
+        Chain& chain = m_chains.back();
+        chain.branch = static_cast<ValueId>(m_ir.insts.size());
+        chain.branch_block = m_block;
+        terminate(IrOp::branch, cond, 0, 0);
+        start_block();
+        m_ir.insts[chain.branch].b = m_block;
+    }
+
+    // Records where the arm leaves (if it does) and which of the chain's
+    // slots it changed, then rolls them back for the next arm.
+    void end_arm() {
+        const Chain& chain = m_chains.back();
+        if (m_block != k_no_block) {
+            const auto jump = static_cast<ValueId>(m_ir.insts.size());
+            const BlockId from = m_block;
+            terminate(IrOp::jump, 0, 0, 0);
+            m_stamp++;
+            const size_t edits_begin = m_edits.size();
+            for (size_t idx = m_log.size(); idx > chain.log_begin; idx--) {
+                const std::uint32_t slot = m_log[idx - 1].slot;
+                if (slot < chain.var_count && m_marks[slot] != m_stamp) {
+                    m_marks[slot] = m_stamp;
+                    m_edits.push_back({ slot, m_vars[slot] });
+                }
+            }
+            m_exits.push_back({ from, jump, edits_begin, m_edits.size() });
+        }
+        for (size_t idx = m_log.size(); idx > chain.log_begin; idx--) {
+            const Assignment& entry = m_log[idx - 1];
+            if (entry.slot < chain.var_count) {
+                m_vars[entry.slot] = entry.old_value;
+            }
+        }
+        m_log.resize(chain.log_begin);
+    }
+
+    // Starts the block after the chain, with a phi for every slot whose
+    // value depends on the way in.
+    void end_chain() {
+        const Chain chain = m_chains.back();
+        m_chains.pop_back();
+        const size_t exit_count = m_exits.size() - chain.exits_begin;
+        const size_t edge_count = exit_count + (chain.branch_block != k_no_block ? 1 : 0);
+        if (edge_count == 0) {
+            m_block = k_no_block;
+            return;
+        }
+        start_block();
+        for (size_t idx = chain.exits_begin; idx < m_exits.size(); idx++) {
+            m_ir.insts[m_exits[idx].jump].a = m_block;
+        }
+        if (chain.branch_block != k_no_block) {
+            m_ir.insts[chain.branch].c = m_block;
+        }
+
+        // One row of incoming values per assigned slot, one column per edge,
+        // starting out as the values from before the chain.
+        m_stamp++;
+        m_join_slots.clear();
+        for (size_t idx = chain.edits_begin; idx < m_edits.size(); idx++) {
+            const std::uint32_t slot = m_edits[idx].slot;
+            if (m_marks[slot] != m_stamp) {
+                m_marks[slot] = m_stamp;
+                m_rows[slot] = static_cast<std::uint32_t>(m_join_slots.size());
+                m_join_slots.push_back(slot);
+            }
+        }
+        m_incoming.clear();
+        for (const std::uint32_t slot : m_join_slots) {
+            m_incoming.insert(m_incoming.end(), edge_count, m_vars[slot]);
+        }
+        for (size_t edge = 0; edge < exit_count; edge++) {
+            const ArmExit& arm = m_exits[chain.exits_begin + edge];
+            for (size_t idx = arm.edits_begin; idx < arm.edits_end; idx++) {
+                m_incoming[m_rows[m_edits[idx].slot] * edge_count + edge] = m_edits[idx].value;
+            }
+        }
+        for (size_t row = 0; row < m_join_slots.size(); row++) {
+            const ValueId* const values = m_incoming.data() + row * edge_count;
+            bool same = true;
+            for (size_t edge = 1; edge < edge_count; edge++) {
+                same = same && values[edge] == values[0];
+            }
+            if (same) {
+                assign(m_join_slots[row], values[0]);
+                continue;
+            }
+            const auto first_arg = static_cast<std::uint32_t>(m_ir.phi_args.size());
+            for (size_t edge = 0; edge < edge_count; edge++) {
+                const BlockId from = edge < exit_count ? m_exits[chain.exits_begin + edge].block : chain.branch_block;
+                m_ir.phi_args.push_back({ from, values[edge] });
+            }
+            assign(m_join_slots[row], emit(IrOp::phi, first_arg, static_cast<std::uint32_t>(edge_count), 0));
+        }
+        m_exits.resize(chain.exits_begin);
+        m_edits.resize(chain.edits_begin);
+    }
+
+    // Post-order walk over an explicit stack, left operand first.
+    ValueId lower_expr(const NodeIndex expr) {
+        m_expr_tasks.push_back({ expr, false });
+        while (!m_expr_tasks.empty()) {
+            const ExprTask task = m_expr_tasks.back();
+            m_expr_tasks.pop_back();
+            const AstNode& node = m_ast.node(task.node);
+            const NodeKind kind = m_ast.kind(task.node);
+            if (kind == NodeKind::int_lit) {
+                m_values.push_back(emit_const(m_ast.int_value(task.node)));
+            }
+            else if (kind == NodeKind::ident) {
+                // A let's variable has no value yet in its own initializer.
+                m_values.push_back(node.c < m_vars.size() ? m_vars[node.c] : emit_const(0));
+            }
+            else if (!task.operands_done) {
+                m_expr_tasks.push_back({ task.node, true });
+                m_expr_tasks.push_back({ node.b, false });
+                m_expr_tasks.push_back({ node.a, false });
+            }
+            else {
+                const ValueId rhs = m_values.back();
+                m_values.pop_back();
+                const ValueId lhs = m_values.back();
+                m_values.pop_back();
+                const auto op = static_cast<IrOp>(
+                    static_cast<size_t>(IrOp::add) + static_cast<size_t>(kind) - static_cast<size_t>(NodeKind::add));
+                m_values.push_back(emit(op, lhs, rhs, 0));
+            }
+        }
+        const ValueId value = m_values.back();
+        m_values.pop_back();
+        return value;
+    }
+
+    void assign(const std::uint32_t slot, const ValueId value) {
+        if (!m_chains.empty()) {
+            m_log.push_back({ slot, m_vars[slot] });
+            if (m_marks.size() <= slot) {
+                m_marks.resize(m_vars.size(), 0);
+                m_rows.resize(m_vars.size(), 0);
+            }
+        }
+        m_vars[slot] = value;
+    }
+
+    ValueId emit(const IrOp op, const std::uint32_t a, const std::uint32_t b, const std::uint32_t c) {
+        m_ir.ops.push_back(op);
+        m_ir.insts.push_back({ a, b, c });
+        return static_cast<ValueId>(m_ir.insts.size() - 1);
+    }
+
+    ValueId emit_const(const std::uint64_t value) {
+        return emit(IrOp::const_, static_cast<std::uint32_t>(value), static_cast<std::uint32_t>(value >> 32), 0);
+    }
+
+    void start_block() {
+        m_block = static_cast<BlockId>(m_ir.blocks.size());
+        const auto first = static_cast<std::uint32_t>(m_ir.insts.size());
+        m_ir.blocks.push_back({ first, first });
+    }
+
+    void terminate(const IrOp op, const std::uint32_t a, const std::uint32_t b, const std::uint32_t c) {
+        emit(op, a, b, c);
+        m_ir.blocks[m_block].end = static_cast<std::uint32_t>(m_ir.insts.size());
+        m_block = k_no_block;
+    }
+
+    // Schedules the statements of `list`, first statement on top.
+    void push_stmts(const NodeIndex list) {
+        const ArenaSpan<NodeIndex> stmts = m_ast.stmts(list);
+        for (size_t idx = stmts.size; idx > 0; idx--) {
+            m_tasks.push_back({ TaskKind::stmt, stmts[idx - 1] });
+        }
+    }
+
+    void push_scope(const NodeIndex scope) {
+        m_scopes.push_back(m_vars.size());
+        m_tasks.push_back({ TaskKind::end_scope, scope });
+        push_stmts(scope);
+    }
+
+    enum class TaskKind : std::uint8_t {
+        stmt,
+        // An elif or else.
+        if_pred,
+        end_scope,
+        // The body of an if, elif or else is done.
+        end_arm,
+        end_chain,
+    };
+
+    struct Task {
+        TaskKind kind;
+        NodeIndex node;
+    };
+
+    struct ExprTask {
+        NodeIndex node;
+        bool operands_done;
+    };
+
+    struct Assignment {
+        std::uint32_t slot;
+        ValueId old_value;
+    };
+
+    struct Edit {
+        std::uint32_t slot;
+        ValueId value;
+    };
+
+    // An arm that reaches the join: the jump it ends in, and its edits in
+    // m_edits.
+    struct ArmExit {
+        BlockId block;
+        ValueId jump;
+        size_t edits_begin;
+        size_t edits_end;
+    };
+
+    // An if chain being lowered, with the sizes of m_vars, m_log, m_exits
+    // and m_edits when it began.
+    struct Chain {
+        size_t var_count;
+        size_t log_begin;
+        size_t exits_begin;
+        size_t edits_begin;
+        // The block of the last condition's branch while its zero target is
+        // still open, else k_no_block.
+        BlockId branch_block;
+        ValueId branch;
+    };
+
+    const Ast m_ast;
+    Ir m_ir {};
+    // The block being filled, or k_no_block where code is unreachable.
+    BlockId m_block = k_no_block;
+    // Current value of each live variable, by slot.
+    std::vector<ValueId> m_vars {};
+    // m_vars.size() when each open scope began.
+    std::vector<size_t> m_scopes {};
+    // Assignments inside the open chains, with the values they replaced.
+    std::vector<Assignment> m_log {};
+    std::vector<Chain> m_chains {};
+    std::vector<ArmExit> m_exits {};
+    std::vector<Edit> m_edits {};
+    // Per slot: the m_stamp of the last pass that saw it, and its row in
+    // m_incoming.
+    std::vector<std::uint32_t> m_marks {};
+    std::vector<std::uint32_t> m_rows {};
+    std::uint32_t m_stamp = 0;
+    std::vector<std::uint32_t> m_join_slots {};
+    std::vector<ValueId> m_incoming {};
+    std::vector<ExprTask> m_expr_tasks {};
+    std::vector<ValueId> m_values {};
+    std::vector<Task> m_tasks {};
+};
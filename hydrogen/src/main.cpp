@@ -1,41 +1,307 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <optional>
+#include <string_view>
+#include <charconv>
 #include <vector>
 
 #include "./arena.hpp"
+#include "./astcache.hpp"
 #include "./generation.hpp"
+#include "./ir.hpp"
+#include "./lower.hpp"
+#include "./parallel_parse.hpp"
+#include "./pass_manager.hpp"
+#include "./phase_stats.hpp"
+#include "./resolve.hpp"
+#include "./pipeline.hpp"
+#include "./source.hpp"
 
+enum class Frontend {
+    // Tokenize the whole file, then parse.
+    batch,
+    // Lex on demand while parsing.
+    stream,
+    // Lex on a separate thread, handing tokens to the parser in batches.
+    pipeline,
+};
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Incorrect usage. Correct usage is..." << std::endl;
-        std::cerr << "hydro <input.hy>" << std::endl;
-        return EXIT_FAILURE;
+struct Options {
+    std::string input;
+    Frontend frontend = Frontend::batch;
+    size_t lex_batch_size = PipelinedTokenizer::k_default_batch_size;
+    // Used by the batch front end for sources of at least
+    // k_parallel_tokenize_min_size bytes.
+    size_t lex_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    // Used by the batch front end for programs of at least
+    // k_parallel_parse_min_tokens tokens, unless hash-consing.
+    size_t parse_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    // Share one node between identical expressions in a scope.
+    bool hash_cons = false;
+    // Where to write the parsed AST, if anywhere.
+    std::string emit_ast;
+    // AST cache file to use instead of parsing when it matches the source,
+    // and to refresh when it does not.
+    std::string ast_cache;
+    // Where to write the IR as text, if anywhere.
+    std::string emit_ir;
+    // -O level, see pipeline_for_level().
+    int opt_level = 0;
+    // Passes to run once each, in this order, instead of the -O level's.
+    std::optional<std::vector<PassId>> passes;
+    // Report peak RSS per phase on stderr.
+    bool stats = false;
+};
+
+void usage() {
+    std::cerr << "Incorrect usage. Correct usage is..." << std::endl;
+    std::cerr << "hydro [--lex-threads=<count>] [--parse-threads=<count>] [--stream | --pipeline [--lex-batch=<tokens>]] [--hash-cons] [--emit-ast=<file>] [--use-ast-cache=<file>] [--emit-ir[=<file>]] [-O0 | -O1 | -O2] [--passes=<pass>,...] [--stats] <input.hy | ->" << std::endl;
+}
+
+std::optional<size_t> parse_count(const std::string_view text) {
+    size_t value = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc {} || end != text.data() + text.size() || value == 0) {
+        return {};
+    }
+    return value;
+}
+
+// A comma-separated list of pass names, possibly empty.
+std::optional<std::vector<PassId>> parse_passes(std::string_view text) {
+    std::vector<PassId> passes;
+    while (!text.empty()) {
+        const std::string_view name = text.substr(0, text.find(','));
+        const std::optional<PassId> pass = find_pass(name);
+        if (!pass.has_value()) {
+            std::cerr << "Unknown pass: `" << name << "`" << std::endl;
+            return {};
+        }
+        passes.push_back(pass.value());
+        text.remove_prefix(std::min(text.size(), name.size() + 1));
     }
-    std::string contents;
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+    return passes;
+}
+
+std::optional<Options> parse_options(const int argc, char* argv[]) {
+    Options options;
+    for (int idx = 1; idx < argc; idx++) {
+        const std::string_view arg = argv[idx];
+        if (arg == "--stream") {
+            options.frontend = Frontend::stream;
+        }
+        else if (arg == "--pipeline") {
+            options.frontend = Frontend::pipeline;
+        }
+        else if (arg == "--hash-cons") {
+            options.hash_cons = true;
+        }
+        else if (arg == "--stats") {
+            options.stats = true;
+        }
+        else if (arg.starts_with("--emit-ast=") && arg.size() > 11) {
+            options.emit_ast = arg.substr(11);
+        }
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            options.opt_level = arg[2] - '0';
+        }
+        else if (arg.starts_with("--passes=")) {
+            options.passes = parse_passes(arg.substr(9));
+            if (!options.passes.has_value()) {
+                return {};
+            }
+        }
+        else if (arg == "--emit-ir") {
+            options.emit_ir = "out.ir";
+        }
+        else if (arg.starts_with("--emit-ir=") && arg.size() > 10) {
+            options.emit_ir = arg.substr(10);
+        }
+        else if (arg.starts_with("--use-ast-cache=") && arg.size() > 16) {
+            options.ast_cache = arg.substr(16);
+        }
+        else if (arg.starts_with("--lex-batch=")) {
+            const std::optional<size_t> count = parse_count(arg.substr(arg.find('=') + 1));
+            if (!count.has_value()) {
+                return {};
+            }
+            options.lex_batch_size = count.value();
+        }
+        else if (arg.starts_with("--lex-threads=")) {
+            const std::optional<size_t> count = parse_count(arg.substr(arg.find('=') + 1));
+            if (!count.has_value()) {
+                return {};
+            }
+            options.lex_threads = count.value();
+        }
+        else if (arg.starts_with("--parse-threads=")) {
+            const std::optional<size_t> count = parse_count(arg.substr(arg.find('=') + 1));
+            if (!count.has_value()) {
+                return {};
+            }
+            options.parse_threads = count.value();
+        }
+        else if ((arg.starts_with("-") && arg != "-") || !options.input.empty()) {
+            return {};
+        }
+        else {
+            options.input = arg;
+        }
+    }
+    if (options.input.empty()) {
+        return {};
+    }
+    return options;
+}
+
+// Resolves names (writing slots into `ast`), then lowers the AST to IR.
+Ir lower(const Ast& ast, const SymbolNames symbols, PhaseStats& stats) {
+    stats.begin("resolve");
+    Resolver resolver(ast, symbols);
+    resolver.resolve();
+    stats.end();
+    stats.begin("lower");
+    Ir ir = Lowerer(ast).lower();
+    IrVerifier(ir).verify();
+    stats.end();
+    return ir;
+}
+
+void generate(const Ir& ir, const Options& options, PhaseStats& stats) {
+    if (!options.emit_ir.empty()) {
+        stats.begin("emit IR");
+        std::ofstream file(options.emit_ir, std::ios::out | std::ios::trunc);
+        IrPrinter(ir, file).print();
+        stats.end();
     }
+    stats.begin("codegen");
+    std::ofstream file("out.asm", std::ios::out | std::ios::trunc);
+    Generator generator(ir, file);
+    generator.gen_prog();
+    stats.end();
+}
 
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
+// An AST together with the arena it lives in, so that it can outlive the
+// parser and the tokens.
+struct ParsedProgram {
+    ArenaAllocator arena;
+    Ast ast;
+};
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
-    if (!prog.has_value()) {
+// `parser` is a Parser or a ParallelParser, and may be destroyed as soon as
+// this returns.
+template <typename AnyParser>
+ParsedProgram parse(AnyParser& parser) {
+    const std::optional<Ast> ast = parser.parse_prog();
+    if (!ast.has_value()) {
         std::cerr << "Invalid program" << std::endl;
         exit(EXIT_FAILURE);
     }
+    return { parser.take_arena(), ast.value() };
+}
+
+void write_ast_caches(const Options& options, const AstCacheKey& cache_key, const Ast& ast, const SymbolNames names) {
+    for (const std::string& path : { options.emit_ast, options.ast_cache }) {
+        if (!path.empty()) {
+            write_ast_cache(path, cache_key, ast, names);
+        }
+    }
+}
+
+// Each phase's data goes as soon as no later phase needs it: the tokens
+// (and the parser's scratch space) when parsing is done, and the source
+// with them, as name resolution only reports names, not lines. The AST goes
+// once it has been lowered to IR.
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = parse_options(argc, argv);
+    if (!options.has_value()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    PhaseStats stats(options->stats);
+    stats.begin("read");
+    std::optional<SourceFile> source(std::in_place, options->input);
+    const std::string_view contents = source->view();
+
+    // The source is only hashed when a cache file is involved. A matching
+    // cache file replaces lexing and parsing altogether.
+    std::optional<AstCacheKey> cache_key;
+    std::optional<AstCacheFile> cached;
+    if (!options->emit_ast.empty() || !options->ast_cache.empty()) {
+        cache_key = ast_cache_key(contents, options->hash_cons);
+    }
+    if (!options->ast_cache.empty()) {
+        cached = AstCacheFile::open(options->ast_cache, cache_key.value());
+    }
+    if (cached.has_value()) {
+        source.reset();
+    }
+    stats.end();
+
+    std::optional<Ir> ir;
+    if (cached.has_value()) {
+        if (!options->emit_ast.empty()) {
+            stats.begin("emit AST");
+            write_ast_cache(options->emit_ast, cache_key.value(), cached->ast(), cached->names());
+            stats.end();
+        }
+        ir.emplace(lower(cached->ast(), cached->names(), stats));
+        cached.reset();
+    }
+    else {
+        SymbolTable symbols;
+        std::optional<ParsedProgram> program;
+        switch (options->frontend) {
+            case Frontend::batch: {
+                stats.begin("lex");
+                TokenBuffer tokens = tokenize_parallel(contents, symbols, options->lex_threads);
+                stats.end();
+                stats.begin("parse");
+                if (options->parse_threads > 1 && !options->hash_cons && tokens.size() >= k_parallel_parse_min_tokens) {
+                    ParallelParser parser(std::move(tokens), options->parse_threads);
+                    program.emplace(parse(parser));
+                }
+                else {
+                    Parser parser(std::move(tokens), options->hash_cons);
+                    program.emplace(parse(parser));
+                }
+                break;
+            }
+            case Frontend::stream: {
+                stats.begin("parse");
+                Parser parser(TokenStream(contents, Tokenizer(contents, symbols)), options->hash_cons);
+                program.emplace(parse(parser));
+                break;
+            }
+            case Frontend::pipeline: {
+                stats.begin("parse");
+                Parser parser(TokenStream(contents, PipelinedTokenizer(contents, symbols, options->lex_batch_size)),
+                    options->hash_cons);
+                program.emplace(parse(parser));
+                break;
+            }
+        }
+        source.reset();
+        symbols.seal();
+        stats.end();
 
-    {
-        Generator generator(prog.value());
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog();
+        if (cache_key.has_value()) {
+            stats.begin("emit AST");
+            write_ast_caches(options.value(), cache_key.value(), program->ast, symbols.names());
+            stats.end();
+        }
+        ir.emplace(lower(program->ast, symbols.names(), stats));
+        program.reset();
+    }
+    PassManager passes(ir.value());
+    stats.begin("optimize");
+    passes.run(options->passes.has_value() ? Pipeline { options->passes.value(), false }
+                                           : pipeline_for_level(options->opt_level));
+    stats.end();
+    generate(ir.value(), options.value(), stats);
+    stats.print(std::cerr);
+    if (options->stats) {
+        passes.print(std::cerr);
     }
 
     system("nasm -felf64 out.asm");
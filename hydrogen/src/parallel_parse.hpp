@@ -0,0 +1,196 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./arena.hpp"
+#include "./ast.hpp"
+#include "./parser.hpp"
+#include "tokenization.hpp"
+
+// Programs with fewer tokens than this are not worth splitting across
+// threads.
+inline constexpr size_t k_parallel_parse_min_tokens = 1024 * 1024;
+
+// Splits the top level of `tokens` into at most `count` parts that can be
+// parsed independently. Returns the first token of each part followed by
+// tokens.size(). A part starts a statement at brace depth 0, right after a
+// `;` or a `}` that is not followed by an elif or else. Finding the
+// boundaries is one pass over the token kinds.
+//
+// In a program that parses, those are exactly the points where the parser
+// has no scope or if chain open. In one that does not, the first part that
+// fails holds the first error of a sequential parse: everything before it
+// parsed fine, so a sequential parse gets to its start in the same state.
+inline std::vector<size_t> find_stmt_boundaries(const TokenBuffer& tokens, const size_t count) {
+    std::vector<size_t> bounds { 0 };
+    std::ptrdiff_t depth = 0; // Before token `idx`.
+    size_t idx = 0;
+    for (size_t part = 1; part < count; part++) {
+        const size_t target = tokens.size() / count * part;
+        for (; idx < tokens.size(); idx++) {
+            const TokenType type = tokens.type(idx);
+            if (idx >= target && idx > bounds.back() && depth == 0 && type != TokenType::elif && type != TokenType::else_) {
+                const TokenType prev = tokens.type(idx - 1);
+                if (prev == TokenType::semi || prev == TokenType::close_curly) {
+                    bounds.push_back(idx);
+                    break;
+                }
+            }
+            if (type == TokenType::open_curly) {
+                depth++;
+            }
+            else if (type == TokenType::close_curly) {
+                depth--;
+            }
+        }
+    }
+    bounds.push_back(tokens.size());
+    return bounds;
+}
+
+// Parses the top level of a program on up to `thread_count` threads. Each
+// part gets its own Parser, and with it its own arena, so the threads share
+// nothing while parsing. The parts are then copied into one Ast in source
+// order, again one thread per part, with their node and list indices
+// shifted. The result is the same Ast, array for array, as Parser gives.
+//
+// Hash-consing is not supported, as it shares expressions across the
+// statements of a scope, the top level included.
+class ParallelParser {
+public:
+    ParallelParser(TokenBuffer tokens, const size_t thread_count)
+        : m_tokens(std::move(tokens))
+        , m_thread_count(thread_count)
+        , m_allocator(1024 * 1024) {
+    }
+
+    std::optional<Ast> parse_prog() {
+        const std::vector<size_t> bounds = find_stmt_boundaries(m_tokens, m_thread_count);
+        const size_t part_count = bounds.size() - 1;
+        m_parsers = std::make_unique<std::optional<Parser<TokenBufferView>>[]>(part_count);
+        std::vector<Ast> parts(part_count);
+        // A part that fails records its message and ends its thread. Once
+        // every thread is joined, the first failed part reports: all parts
+        // before it parsed, so its error is the one a sequential parse
+        // would stop at.
+        std::vector<std::optional<std::string>> errors(part_count);
+        run_parts(part_count, [&](const size_t part) {
+            // Started at the token before the part, so that a diagnostic
+            // at its first statement names the same line as in a
+            // sequential parse.
+            Parser<TokenBufferView>& parser
+                = m_parsers[part].emplace(TokenBufferView(m_tokens, part == 0 ? 0 : bounds[part] - 1, bounds[part + 1]));
+            parser.set_error_handler([](const std::string& msg) {
+                throw PartError { msg };
+            });
+            try {
+                if (part > 0) {
+                    parser.skip_token();
+                }
+                parts[part] = parser.parse_prog().value();
+            }
+            catch (PartError& error) {
+                errors[part] = std::move(error.msg);
+            }
+        });
+        for (const std::optional<std::string>& error : errors) {
+            if (error.has_value()) {
+                std::cerr << error.value() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (part_count == 1) {
+            return parts[0];
+        }
+
+        // Every part ends in its own prog node, whose statement list is the
+        // last one in its lists. Scope lists go first, in part order, then
+        // the statement lists of the prog nodes make up the new one.
+        struct Placement {
+            size_t nodes;
+            size_t lists;
+            size_t stmts;
+        };
+        std::vector<Placement> placements(part_count);
+        Placement total {};
+        for (size_t part = 0; part < part_count; part++) {
+            const AstNode& prog = parts[part].node(parts[part].root());
+            placements[part] = total;
+            total.nodes += parts[part].kinds.size - 1;
+            total.lists += prog.a;
+            total.stmts += prog.b;
+        }
+        const Ast ast {
+            alloc_span<NodeKind>(total.nodes + 1),
+            alloc_span<AstNode>(total.nodes + 1),
+            alloc_span<NodeIndex>(total.lists + total.stmts),
+        };
+        run_parts(part_count, [&](const size_t part) {
+            const Ast& from = parts[part];
+            const Placement& to = placements[part];
+            const auto node_base = static_cast<std::uint32_t>(to.nodes);
+            const auto list_base = static_cast<std::uint32_t>(to.lists);
+            for (size_t idx = 0; idx + 1 < from.kinds.size; idx++) {
+                ast.kinds[to.nodes + idx] = from.kinds[idx];
+                ast.nodes[to.nodes + idx] = relocate_node(from.kinds[idx], from.nodes[idx], node_base, list_base);
+            }
+            const AstNode& prog = from.node(from.root());
+            for (size_t idx = 0; idx < prog.a; idx++) {
+                ast.lists[to.lists + idx] = from.lists[idx] + node_base;
+            }
+            for (size_t idx = 0; idx < prog.b; idx++) {
+                ast.lists[total.lists + to.stmts + idx] = from.lists[prog.a + idx] + node_base;
+            }
+        });
+        ast.kinds[total.nodes] = NodeKind::prog;
+        ast.nodes[total.nodes]
+            = { static_cast<std::uint32_t>(total.lists), static_cast<std::uint32_t>(total.stmts), 0 };
+        // The parts are copied out, so their arenas can go.
+        m_parsers.reset();
+        return ast;
+    }
+
+    // Same as Parser::take_arena().
+    [[nodiscard]] ArenaAllocator take_arena() {
+        if (m_parsers != nullptr) {
+            return m_parsers[0]->take_arena();
+        }
+        return std::move(m_allocator);
+    }
+
+private:
+    // Thrown out of a part's parser in place of its syntax error.
+    struct PartError {
+        std::string msg;
+    };
+
+    // Calls `task` for each part, part 0 on the calling thread.
+    template <typename Task>
+    static void run_parts(const size_t part_count, Task task) {
+        std::vector<std::thread> workers;
+        for (size_t part = 1; part < part_count; part++) {
+            workers.emplace_back(task, part);
+        }
+        task(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    template <typename T>
+    ArenaSpan<T> alloc_span(const size_t size) {
+        return { static_cast<T*>(m_allocator.alloc_bytes(sizeof(T) * size, alignof(T))), size };
+    }
+
+    TokenBuffer m_tokens;
+    size_t m_thread_count;
+    // One per part. Only kept after parse_prog() when there was just one
+    // part, whose Ast is returned as it is.
+    std::unique_ptr<std::optional<Parser<TokenBufferView>>[]> m_parsers;
+    ArenaAllocator m_allocator;
+};
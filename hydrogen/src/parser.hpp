@@ -1,400 +1,541 @@
 #pragma once
 
-#include <variant>
 #include <cassert>
+#include <functional>
 
 #include "./arena.hpp"
+#include "./ast.hpp"
+#include "./grammar.hpp"
+#include "./hashcons.hpp"
 #include "tokenization.hpp"
 
-struct NodeTermIntLit {
-    Token int_lit;
-};
-
-struct NodeTermIdent {
-    Token ident;
-};
-
-struct NodeExpr;
-struct NodeTermParen {
-    NodeExpr* expr;
-};
-
-// Using arena allocation
-struct NodeBinExprAdd {
-    NodeExpr* lft_hnd_side;
-    NodeExpr* rght_hnd_side;
-};
-
-struct NodeBinExprSub {
-    NodeExpr* lft_hnd_side;
-    NodeExpr* rght_hnd_side;
-};
-
-struct NodeBinExprDiv {
-    NodeExpr* lft_hnd_side;
-    NodeExpr* rght_hnd_side;
-};
-
-struct NodeBinExprMulti {
-    NodeExpr* lft_hnd_side;
-    NodeExpr* rght_hnd_side;
-};
-
-struct NodeBinExpr {
-    std::variant<NodeBinExprAdd*, NodeBinExprSub*, NodeBinExprMulti*, NodeBinExprDiv*> var;
-};
-
-struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*> var;
-};
-
-struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
-// End of arena allocation
-
-struct NodeStmtExit {
-    NodeExpr* expr;
-};
-
-struct NodeStmtLet {
-    Token ident;
-    NodeExpr* expr{};
-};
-
-struct NodeStmt;
-struct NodeScope {
-    std::vector<NodeStmt*> stmts;
-};
-
-struct NodeIfPred;
-struct NodeIfPredElif {
-    NodeExpr* expr{};
-    NodeScope* scope{};
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeIfPredElse {
-    NodeScope* scope;
-};
-
-struct NodeIfPred {
-    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
-};
-
-struct NodeStmtIf {
-    NodeExpr* expr{};
-    NodeScope* scope{};
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeStmtAssign {
-    Token ident;
-    NodeExpr* expr {};
-};
-
-struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*> var;
-};
-
-struct NodeProg {
-    std::vector<NodeStmt*> stmts;
-};
-
+// Wraps around on overflow, like the 64-bit immediate it ends up in.
+inline std::uint64_t parse_int_lit(const std::string_view text) {
+    std::uint64_t value = 0;
+    for (const char c : text) {
+        value = value * 10 + static_cast<std::uint64_t>(c - '0');
+    }
+    return value;
+}
+
+// `Tokens` is either a TokenBuffer holding the whole token stream or a
+// TokenStream that lexes on demand. The returned Ast lives in the parser's
+// arena, so the parser has to outlive it.
+//
+// With `hash_cons`, identical expressions within a scope share one node, and
+// the AST becomes a DAG.
+template <typename Tokens>
 class Parser {
 public:
-    explicit Parser(std::vector<Token> tokens) 
+    explicit Parser(Tokens tokens, const bool hash_cons = false)
         : m_tokens(std::move(tokens))
-        , m_allocator(1024 * 1024 * 4) { // 4mb
+        , m_allocator(1024 * 1024) // 1mb first chunk, grows as needed
+        , m_scratch(64 * 1024)
+        , m_kinds(node_arena())
+        , m_nodes(node_arena())
+        , m_lists(m_scratch)
+        , m_pending(m_scratch)
+        , m_open(m_scratch)
+        , m_branches(m_scratch)
+        , m_operands(m_scratch)
+        , m_operators(m_scratch) {
+        // Every node consumes at least one token (the prog node aside), so a
+        // complete token buffer bounds the node count. Pages of the
+        // reservation that are never reached are never touched either.
+        if constexpr (requires { m_tokens.size(); }) {
+            m_kinds.reserve(m_tokens.size() + 1);
+            m_nodes.reserve(m_tokens.size() + 1);
+        }
+        if (hash_cons) {
+            m_exprs.emplace();
+        }
+    }
+
+    // Gets every syntax error in place of printing it and exiting. The
+    // handler must not return; ParallelParser throws from it, so that a
+    // part that fails ends its thread instead of the process.
+    void set_error_handler(std::function<void(const std::string&)> handler) {
+        m_error_handler = std::move(handler);
     }
 
     void error_expected(const std::string& msg) const {
-        std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+        const int line = m_curr_idx > 0 ? m_tokens.line(m_curr_idx - 1) : 1;
+        error("[Parse Error] Expected " + msg + " on line " + std::to_string(line));
     }
 
-    std::optional<NodeBinExpr*> parse_bin_expr() {
-        if (auto lft_hnd_side = parse_expr()) {
-            auto bin_expr = m_allocator.emplace<NodeBinExpr>();
-            if (peek().has_value() && peek().value().type == TokenType::plus) {
-                auto bin_expr_add = m_allocator.emplace<NodeBinExprAdd>();
-                bin_expr_add->lft_hnd_side = lft_hnd_side.value();
-                consume();
-                if (auto rght_hnd_side = parse_expr()) {
-                    bin_expr_add->rght_hnd_side = rght_hnd_side.value();
-                    bin_expr->var = bin_expr_add;
-                    return bin_expr;
-                }
-                else {
-                    error_expected("expression");
-                }
-            }
-            else {
-                std::cerr << "Unsupported binary operator" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-        }
-        else {
-            return {};
+    void error(const std::string& msg) const {
+        if (m_error_handler) {
+            m_error_handler(msg);
         }
+        std::cerr << msg << std::endl;
+        exit(EXIT_FAILURE);
     }
 
-    std::optional<NodeTerm*> parse_term() {
+    std::optional<NodeIndex> parse_term() {
         if (const auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(int_lit.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_int_lit);
-
-            return term;
+            const std::uint64_t value = parse_int_lit(m_tokens.at(int_lit.value()).value);
+            return add_expr_node(NodeKind::int_lit, static_cast<std::uint32_t>(value), static_cast<std::uint32_t>(value >> 32));
         }
         if (const auto ident = try_consume(TokenType::ident)) {
-            auto term_ident = m_allocator.emplace<NodeTermIdent>(ident.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_ident);
-            return term;
-        }
-        if (const auto open_paren = try_consume(TokenType::open_paren)) {
-            auto expr = parse_expr();
-            if (!expr.has_value()) {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::close_paren);
-            auto term_paren = m_allocator.emplace<NodeTermParen>(expr.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_paren);
-            return term;
+            return add_expr_node(NodeKind::ident, m_tokens.at(ident.value()).symbol, 0);
         }
         return {};
     }
 
-    std::optional<NodeExpr*> parse_expr(const int min_prec = 0) {
-        std::optional<NodeTerm*> term_lft_hnd_side = parse_term();
-        if (!term_lft_hnd_side.has_value()) {
-            return {};
-        }
-        auto expr_lft_hnd_side = m_allocator.emplace<NodeExpr>(term_lft_hnd_side.value());
-        while(true) {
-            std::optional<Token> curr_tok = peek();
+    // Operator precedence parsing with explicit operand and operator stacks
+    // (parentheses included), so nesting depth costs heap memory rather than
+    // native stack. Binary operators are left-associative.
+    std::optional<NodeIndex> parse_expr() {
+        const size_t operands_base = m_operands.size();
+        const size_t operators_base = m_operators.size();
+        size_t open_parens = 0;
+        while (true) {
+            while (try_consume(TokenType::open_paren)) {
+                m_operators.push_back(TokenType::open_paren);
+                open_parens++;
+            }
+            const std::optional<NodeIndex> term = parse_term();
+            if (!term.has_value()) {
+                if (m_operands.size() == operands_base && open_parens == 0) {
+                    return {};
+                }
+                error_expected("expression");
+            }
+            m_operands.push_back(term.value());
+
+            // Close as many groups as there are `)`, then either continue
+            // with the next operator or stop.
             std::optional<int> prec;
-            if (curr_tok.has_value()) {
-                prec = bin_prec(curr_tok->type);
-                if (!prec.has_value() || prec < min_prec) {
+            while (true) {
+                const std::optional<TokenType> type = peek_type();
+                prec = type.has_value() ? bin_prec(type.value()) : std::nullopt;
+                if (prec.has_value() || open_parens == 0) {
                     break;
                 }
+                reduce_operators(operators_base, 0);
+                try_consume_err(TokenType::close_paren);
+                m_operators.pop_back();
+                open_parens--;
             }
-            else {
+            if (!prec.has_value()) {
                 break;
             }
-            const auto [type, line, value] = consume();
-            const int next_min_prec = prec.value() + 1;
-            auto expr_rght_hnd_side = parse_expr(next_min_prec);
-            if (!expr_rght_hnd_side.has_value()) {
-                error_expected("expression");
-            }
-            auto expr = m_allocator.emplace<NodeBinExpr>();
-            auto expr_lft_hnd_side_v2 = m_allocator.emplace<NodeExpr>();
-            if (type == TokenType::plus) {
-                expr_lft_hnd_side_v2->var = expr_lft_hnd_side->var;
-                auto add = m_allocator.emplace<NodeBinExprAdd>(expr_lft_hnd_side_v2, expr_rght_hnd_side.value());
-                expr->var = add;
-            }
-            else if (type == TokenType::star) {
-                expr_lft_hnd_side_v2->var = expr_lft_hnd_side->var;
-                auto multi = m_allocator.emplace<NodeBinExprMulti>(expr_lft_hnd_side_v2, expr_rght_hnd_side.value());
-                expr->var = multi;
-            } 
-            else if (type == TokenType::minus) {
-                expr_lft_hnd_side_v2->var = expr_lft_hnd_side->var;
-                auto sub = m_allocator.emplace<NodeBinExprSub>(expr_lft_hnd_side_v2, expr_rght_hnd_side.value());
-                expr->var = sub;
-            } 
-            else if (type == TokenType::fslash) {
-                expr_lft_hnd_side_v2->var = expr_lft_hnd_side->var;
-                auto div = m_allocator.emplace<NodeBinExprDiv>(expr_lft_hnd_side_v2, expr_rght_hnd_side.value());
-                expr->var = div;
-            } 
-            else {
+            reduce_operators(operators_base, prec.value());
+            m_operators.push_back(m_tokens.type(consume()));
+        }
+        reduce_operators(operators_base, 0);
+        const NodeIndex expr = m_operands[operands_base];
+        m_operands.truncate(operands_base);
+        return expr;
+    }
+
+    // exit, let and assignment: the statements that do not contain a scope.
+    // `start` is the statement's first token; the lookahead tokens of `rule`
+    // have been consumed already.
+    NodeIndex parse_simple_stmt(const Rule rule, const size_t start) {
+        // Read before parse_expr() moves on, as a TokenStream only keeps
+        // the tokens around the cursor.
+        const SymbolId symbol = rule == Rule::exit ? 0 : m_tokens.at(rule == Rule::let ? start + 1 : start).symbol;
+        const std::optional<NodeIndex> expr = parse_expr();
+        switch (rule) {
+            case Rule::exit:
+                if (!expr.has_value()) {
+                    error("Invalid expression");
+                }
+                try_consume_err(TokenType::close_paren);
+                try_consume_err(TokenType::semi);
+                return add_node(NodeKind::stmt_exit, expr.value());
+            case Rule::let:
+                if (!expr.has_value()) {
+                    error("Invalid expression");
+                }
+                try_consume_err(TokenType::semi);
+                return add_node(NodeKind::stmt_let, symbol, expr.value());
+            case Rule::assign:
+                if (!expr.has_value()) {
+                    error_expected("expression");
+                }
+                try_consume_err(TokenType::semi);
+                return add_node(NodeKind::stmt_assign, symbol, expr.value());
+            default:
                 assert(false); // Unreachable;
-            }
-            expr_lft_hnd_side->var = expr;
+                return k_no_node;
+        }
+    }
+
+    std::optional<Ast> parse_prog() {
+        parse_stmts(false, false);
+        add_list_node(NodeKind::prog, 0);
+        return Ast { m_kinds.finish(m_allocator), m_nodes.finish(m_allocator), m_lists.finish(m_allocator) };
+    }
+
+    // Hands over the arena the Ast from parse_prog() lives in, so that the
+    // parser, and the tokens and scratch space it holds, can go while the
+    // Ast is still in use. The arena holds nothing but the Ast (and spans,
+    // when tracked); the unused part of the node reservation is address
+    // space that was never touched. The parser must not be used afterwards.
+    [[nodiscard]] ArenaAllocator take_arena() {
+        return std::move(m_allocator);
+    }
+
+    // Records a SourceSpan for every statement and scope node, available
+    // through finish_spans(). Has to be called before parsing.
+    void track_spans() {
+        m_spans.emplace(m_allocator);
+    }
+
+    // Piecewise parsing, for callers that keep state per statement (see
+    // IncrementalDocument). Parses the next statement of the current
+    // statement list and returns its root, or k_no_node once the list ends:
+    // at the end of the input, or with `in_scope`, at the `}` closing the
+    // scope the parser was started in (which is left unconsumed). Statements
+    // that cannot start there are reported as in a full parse.
+    NodeIndex parse_next_stmt(const bool in_scope) {
+        parse_stmts(true, in_scope);
+        if (m_pending.empty()) {
+            return k_no_node;
         }
-        return expr_lft_hnd_side;
+        const NodeIndex stmt = m_pending.back();
+        m_pending.pop_back();
+        return stmt;
     }
 
-    std::optional<NodeScope*> parse_scope() {
-        if (!try_consume(TokenType::open_curly).has_value()) {
+    // Consumes the first token without parsing it. Piecewise parsing starts
+    // at the token before the first statement (the `{` of its scope, say),
+    // so that a diagnostic right at that statement names the same line as
+    // in a full parse.
+    void skip_token() {
+        consume();
+    }
+
+    // Source offset of the next token, if there is one.
+    [[nodiscard]] std::optional<std::uint32_t> next_offset() {
+        if (!m_tokens.has(m_curr_idx)) {
             return {};
         }
-        auto scope = m_allocator.emplace<NodeScope>();
-        while (auto stmt = parse_stmt()) {
-            scope->stmts.push_back(stmt.value());
+        return m_tokens.offset(m_curr_idx);
+    }
+
+    // Everything built by parse_next_stmt(), without a prog node. The
+    // parser must not be used afterwards.
+    [[nodiscard]] Ast finish_nodes() {
+        return Ast { m_kinds.finish(m_allocator), m_nodes.finish(m_allocator), m_lists.finish(m_allocator) };
+    }
+
+    // Indexed like the nodes; zero for nodes that are neither a statement
+    // nor a scope.
+    [[nodiscard]] ArenaSpan<SourceSpan> finish_spans() {
+        return m_spans->finish();
+    }
+
+private:
+    // The cursor hands out token kinds and indices; a Token is only
+    // materialized (through m_tokens.at) when a node needs its contents.
+    [[nodiscard]] std::optional<TokenType> peek_type(const size_t offset = 0) {
+        if (!m_tokens.has(m_curr_idx + offset)) {
+            return {};
         }
-        try_consume_err(TokenType::close_curly);
-        return scope;
+        return m_tokens.type(m_curr_idx + offset);
     }
 
-    std::optional<NodeIfPred*> parse_if_pred() {
-        if (try_consume(TokenType::elif)) {
-            try_consume_err(TokenType::open_paren);
-            const auto elif_ = m_allocator.alloc<NodeIfPredElif>();
-            if (const auto expr = parse_expr()) {
-                elif_->expr = expr.value();
-            }
-            else {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::close_paren);
-            if (const auto scope = parse_scope()) {
-                elif_->scope = scope.value();
-            }
-            else {
-                error_expected("scope");
-            }
-            elif_->pred = parse_if_pred();
-            auto pred = m_allocator.emplace<NodeIfPred>(elif_);
-            return pred;
+    [[nodiscard]] bool peek_is(const TokenType type, const size_t offset = 0) {
+        return m_tokens.has(m_curr_idx + offset) && m_tokens.type(m_curr_idx + offset) == type;
+    }
+
+    // Returns the index of the consumed token.
+    size_t consume() {
+        return m_curr_idx++;
+    }
+
+    size_t try_consume_err(const TokenType type) {
+        if (peek_is(type)) {
+            return consume();
         }
-        if (try_consume(TokenType::else_)) {
-            auto else_ = m_allocator.alloc<NodeIfPredElse>();
-            if (const auto scope = parse_scope()) {
-                else_->scope = scope.value();
-            }
-            else {
-                error_expected("scope");
-            }
-            auto pred = m_allocator.emplace<NodeIfPred>(else_);
-            return pred;
+        error_expected(to_string(type));
+        return {};
+    }
+
+    std::optional<size_t> try_consume(const TokenType type) {
+        if (peek_is(type)) {
+            return consume();
         }
         return {};
     }
 
-    std::optional<NodeStmt*> parse_stmt() {
-        if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren) {
-            consume();
-            consume();
-            auto stmt_exit = m_allocator.emplace<NodeStmtExit>();
-            if (const auto node_expr = parse_expr()) {
-                stmt_exit->expr = node_expr.value();
+    // The rule `table` selects at the cursor, with its lookahead tokens
+    // consumed; Rule::none (and nothing consumed) if there is none. One table
+    // load plus at most k - 1 token compares, however many rules there are.
+    [[nodiscard]] Rule take_rule(const std::array<RuleDispatch, k_token_type_count>& table) {
+        const std::optional<TokenType> type = peek_type();
+        if (!type.has_value()) {
+            return Rule::none;
+        }
+        const RuleDispatch& dispatch = table[static_cast<size_t>(type.value())];
+        for (size_t pos = 1; pos < dispatch.lookahead; pos++) {
+            if (!peek_is(dispatch.prefix[pos], pos)) {
+                return Rule::none;
             }
-            else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+        }
+        m_curr_idx += dispatch.lookahead;
+        return dispatch.rule;
+    }
+
+    // Parses statements up to the end of the input. Scopes and if chains
+    // that are still open are kept on m_open instead of the native stack, so
+    // nesting depth is only limited by memory.
+    //
+    // With `one_stmt`, returns as soon as one statement of the outermost
+    // list is done; with `in_scope`, that list ends at a `}` rather than at
+    // the end of the input (see parse_next_stmt()).
+    void parse_stmts(const bool one_stmt, const bool in_scope) {
+        while (true) {
+            if (one_stmt && m_open.empty() && !m_pending.empty()) {
+                return;
             }
-            try_consume_err(TokenType::close_paren);
-            try_consume_err(TokenType::semi);
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_exit;
-            return stmt;
-        } 
-        if (peek().has_value() && peek().value().type == TokenType::let
-            && peek(1).has_value() && peek(1).value().type == TokenType::ident
-            && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
-
-            consume();
-            auto stmt_let = m_allocator.emplace<NodeStmtLet>();
-            stmt_let->ident = consume();
-            consume();
-            if (const auto expr = parse_expr()) {
-                stmt_let->expr = expr.value();
+            const size_t start = m_curr_idx;
+            const Rule rule = take_rule(k_stmt_dispatch);
+            switch (rule) {
+                case Rule::exit:
+                case Rule::let:
+                case Rule::assign: {
+                    const SourceSpan first = m_spans.has_value() ? token_span(start) : SourceSpan {};
+                    const NodeIndex stmt = parse_simple_stmt(rule, start);
+                    set_span(stmt, { first.begin, first.end, last_offset() });
+                    m_pending.push_back(stmt);
+                    continue;
+                }
+                case Rule::block:
+                    open_scope();
+                    continue;
+                case Rule::if_: {
+                    // Read before the condition moves the token window on.
+                    const SourceSpan span = m_spans.has_value() ? token_span(start) : SourceSpan {};
+                    try_consume_err(TokenType::open_paren);
+                    const std::optional<NodeIndex> expr = parse_expr();
+                    if (!expr.has_value()) {
+                        error("Invalid if expression");
+                    }
+                    try_consume_err(TokenType::close_paren);
+                    if (!try_consume(TokenType::open_curly)) {
+                        error("Invalid scope");
+                    }
+                    m_open.push_back({ NodeKind::stmt_if, m_branches.size(), 0, span });
+                    m_branches.push_back({ expr.value(), k_no_node });
+                    open_scope();
+                    continue;
+                }
+                default:
+                    break;
             }
-            else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+
+            // Nothing starts a statement here, so the innermost scope ends.
+            if (m_open.empty()) {
+                if (in_scope) {
+                    if (!peek_is(TokenType::close_curly)) {
+                        error_expected(to_string(TokenType::close_curly));
+                    }
+                    return;
+                }
+                if (peek_type().has_value()) {
+                    error("Invalid statement");
+                }
+                return;
             }
-            try_consume_err(TokenType::semi);
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
-        }
-        if (peek().has_value() && peek().value().type == TokenType::ident 
-            && peek(1).has_value() && peek(1).value().type == TokenType::eq) {
-            const auto assign = m_allocator.alloc<NodeStmtAssign>();
-            assign->ident = consume();
-            consume();
-            if (const auto expr = parse_expr()) {
-                assign->expr = expr.value();
+            try_consume_err(TokenType::close_curly);
+            const NodeIndex scope = close_scope();
+            if (m_open.empty() || m_open.back().kind == NodeKind::scope) {
+                m_pending.push_back(scope);
+                continue;
             }
-            else {
-                error_expected("expression");
+
+            // The scope is the body of the latest branch of an if chain.
+            m_branches.back().scope = scope;
+            const bool after_else = m_branches.back().expr == k_no_node;
+            const Rule pred = after_else ? Rule::none : take_rule(k_if_pred_dispatch);
+            if (pred == Rule::elif) {
+                try_consume_err(TokenType::open_paren);
+                const std::optional<NodeIndex> expr = parse_expr();
+                if (!expr.has_value()) {
+                    error_expected("expression");
+                }
+                try_consume_err(TokenType::close_paren);
+                if (!try_consume(TokenType::open_curly)) {
+                    error_expected("scope");
+                }
+                m_branches.push_back({ expr.value(), k_no_node });
+                open_scope();
+                continue;
             }
-            try_consume_err(TokenType::semi);
-            const auto stmt = m_allocator.emplace<NodeStmt>(assign);
-            return stmt;
-        }
-        if (peek().has_value() && peek().value().type == TokenType::open_curly) {
-            if (auto scope = parse_scope()) {
-                auto stmt = m_allocator.emplace<NodeStmt>();
-                stmt->var = scope.value();
-                return stmt;
+            if (pred == Rule::else_) {
+                if (!try_consume(TokenType::open_curly)) {
+                    error_expected("scope");
+                }
+                m_branches.push_back({ k_no_node, k_no_node });
+                open_scope();
+                continue;
             }
-            std::cerr << "Invalid scope" << std::endl;
-            exit(EXIT_FAILURE);
+            m_pending.push_back(close_if_chain());
         }
-        if (const auto if_ = try_consume(TokenType::if_)) {
-            try_consume_err(TokenType::open_paren);
-            auto stmt_if = m_allocator.emplace<NodeStmtIf>();
-            if (auto expr = parse_expr()) {
-                stmt_if->expr = expr.value();
-            }
-            else {
-                std::cerr << "Invalid if expression" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            try_consume_err(TokenType::close_paren);
-            if (const auto scope = parse_scope()) {
-                stmt_if->scope = scope.value();
+    }
+
+    // Called right after the `{`.
+    void open_scope() {
+        const SourceSpan span = m_spans.has_value() ? token_span(m_curr_idx - 1) : SourceSpan {};
+        m_open.push_back({ NodeKind::scope, m_pending.size(), m_exprs.has_value() ? m_exprs->mark() : 0, span });
+    }
+
+    // Called right after the `}`.
+    NodeIndex close_scope() {
+        const OpenStmt scope = m_open.back();
+        m_open.pop_back();
+        if (m_exprs.has_value()) {
+            m_exprs->release(scope.exprs_mark);
+        }
+        const NodeIndex node = add_list_node(NodeKind::scope, scope.first);
+        if (m_spans.has_value()) {
+            set_span(node, { scope.span.begin, last_offset(), last_offset() });
+        }
+        return node;
+    }
+
+    // Builds the nodes of the if chain on top of m_open, innermost branch
+    // first, the same order a recursive descent would.
+    NodeIndex close_if_chain() {
+        const size_t first = m_open.back().first;
+        const SourceSpan span = m_open.back().span;
+        m_open.pop_back();
+        NodeIndex pred = k_no_node;
+        for (size_t idx = m_branches.size() - 1; idx > first; idx--) {
+            const Branch& branch = m_branches[idx];
+            if (branch.expr == k_no_node) {
+                pred = add_node(NodeKind::pred_else, branch.scope);
             }
             else {
-                std::cerr << "Invalid scope" << std::endl;
-                exit(EXIT_FAILURE);
+                pred = add_node(NodeKind::pred_elif, branch.expr, branch.scope, pred);
             }
-            stmt_if->pred = parse_if_pred();
-            auto stmt = m_allocator.emplace<NodeStmt>(stmt_if);
-            stmt->var = stmt_if;
-            return stmt;
         }
-        return {};
+        const NodeIndex stmt_if = add_node(NodeKind::stmt_if, m_branches[first].expr, m_branches[first].scope, pred);
+        set_span(stmt_if, { span.begin, span.end, last_offset() });
+        m_branches.truncate(first);
+        return stmt_if;
     }
 
-    std::optional<NodeProg> parse_prog() {
-        NodeProg prog;
-        while (peek().has_value()) {
-            if (auto stmt = parse_stmt()) {
-                prog.stmts.push_back(stmt.value());
-            }
-            else {
-                std::cerr << "Invalid statement" << std::endl;
-                exit(EXIT_FAILURE);
+    // Pops operators (and their operands) while the top one binds at least
+    // as tightly as `min_prec`, stopping at an open parenthesis.
+    void reduce_operators(const size_t operators_base, const int min_prec) {
+        while (m_operators.size() > operators_base) {
+            const TokenType type = m_operators.back();
+            if (type == TokenType::open_paren || bin_prec(type).value() < min_prec) {
+                return;
             }
+            m_operators.pop_back();
+            const NodeIndex rhs = m_operands.back();
+            m_operands.pop_back();
+            const NodeIndex lhs = m_operands.back();
+            m_operands.pop_back();
+            m_operands.push_back(add_expr_node(bin_expr_kind(type), lhs, rhs));
         }
-        return prog;
     }
 
-private:
-    [[nodiscard]] std::optional<Token> peek(const int offset = 0) const {
-        if (m_curr_idx + offset >= m_tokens.size()) {
-            return {};
+    NodeIndex add_node(const NodeKind kind, const std::uint32_t a, const std::uint32_t b = 0, const std::uint32_t c = 0) {
+        const auto idx = static_cast<NodeIndex>(m_kinds.size());
+        m_kinds.push_back(kind);
+        m_nodes.push_back({ a, b, c });
+        if (m_spans.has_value()) {
+            m_spans->push_back({ 0, 0, 0 });
         }
-        return m_tokens.at(m_curr_idx + offset);
+        return idx;
     }
 
-    Token consume() {
-        return m_tokens.at(m_curr_idx++);
+    [[nodiscard]] SourceSpan token_span(const size_t idx) const {
+        const std::uint32_t begin = m_tokens.offset(idx);
+        return { begin, begin + static_cast<std::uint32_t>(m_tokens.at(idx).value.size()), begin };
     }
 
-    Token try_consume_err(const TokenType type) {
-        if (peek().has_value() && peek().value().type == type) {
-            return consume();
+    [[nodiscard]] std::uint32_t last_offset() const {
+        return m_spans.has_value() ? m_tokens.offset(m_curr_idx - 1) : 0;
+    }
+
+    void set_span(const NodeIndex node, const SourceSpan span) {
+        if (m_spans.has_value()) {
+            (*m_spans)[node] = span;
         }
-        error_expected(to_string(type));
-        return {};
     }
 
-    std::optional<Token> try_consume(const TokenType type) {
-        if (peek().has_value() && peek().value().type == type) {
-            return consume();
+    NodeIndex add_expr_node(const NodeKind kind, const std::uint32_t a, const std::uint32_t b) {
+        if (!m_exprs.has_value()) {
+            return add_node(kind, a, b);
+        }
+        if (const std::optional<NodeIndex> existing = m_exprs->find(kind, a, b)) {
+            return existing.value();
+        }
+        const NodeIndex node = add_node(kind, a, b);
+        m_exprs->insert(kind, a, b, node);
+        return node;
+    }
+
+    // Moves the statements pending since `first_stmt` into `lists`, as the
+    // children of a new node of `kind`.
+    NodeIndex add_list_node(const NodeKind kind, const size_t first_stmt) {
+        const auto first = static_cast<std::uint32_t>(m_lists.size());
+        for (size_t idx = first_stmt; idx < m_pending.size(); idx++) {
+            m_lists.push_back(m_pending[idx]);
+        }
+        const auto count = static_cast<std::uint32_t>(m_pending.size() - first_stmt);
+        m_pending.truncate(first_stmt);
+        return add_node(kind, first, count);
+    }
+
+    // With the whole token buffer at hand, the node arrays are reserved up
+    // front where the Ast is going to live. Otherwise they grow in
+    // m_scratch and are copied out once, so that the buffers they outgrew
+    // go with the parser.
+    ArenaAllocator& node_arena() {
+        if constexpr (requires { m_tokens.size(); }) {
+            return m_allocator;
+        }
+        else {
+            return m_scratch;
         }
-        return {};
     }
 
-    const std::vector<Token> m_tokens;
+    Tokens m_tokens;
     size_t m_curr_idx = 0;
+    // Holds the Ast; see take_arena().
     ArenaAllocator m_allocator;
+    // Everything that is only needed while parsing: the statement lists
+    // while they grow, the stacks below, and with a token stream, the node
+    // arrays too.
+    ArenaAllocator m_scratch;
+    ArenaVector<NodeKind> m_kinds;
+    ArenaVector<AstNode> m_nodes;
+    ArenaVector<NodeIndex> m_lists;
+    // Statements of the scopes that are still open, innermost last.
+    ArenaVector<NodeIndex> m_pending;
+
+    // A scope, or an if chain whose branches are m_branches[first..].
+    struct OpenStmt {
+        NodeKind kind;
+        // For a scope, its first statement in m_pending.
+        size_t first;
+        size_t exprs_mark;
+        // The `{`, or the `if` token. Only set when tracking spans.
+        SourceSpan span;
+    };
+
+    // An else branch has no expression.
+    struct Branch {
+        NodeIndex expr;
+        NodeIndex scope;
+    };
+
+    ArenaVector<OpenStmt> m_open;
+    ArenaVector<Branch> m_branches;
+    ArenaVector<NodeIndex> m_operands;
+    ArenaVector<TokenType> m_operators;
+    // Only engaged when hash-consing.
+    std::optional<ExprTable> m_exprs;
+    // Only engaged when tracking spans.
+    std::optional<ArenaVector<SourceSpan>> m_spans;
+    std::function<void(const std::string&)> m_error_handler;
 };
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "./const_fold.hpp"
+#include "./dce.hpp"
+#include "./ir.hpp"
+#include "./simplify_cfg.hpp"
+
+// An optimization pass. It rewrites the IR in place and returns how many
+// changes it made, 0 when there was nothing to do.
+struct Pass {
+    std::string_view name;
+    size_t (*run)(Ir& ir);
+};
+
+inline constexpr Pass k_passes[] = {
+    { "const-fold", [](Ir& ir) { return ConstantFolding(ir).run(); } },
+    { "simplify-cfg", [](Ir& ir) { return SimplifyCfg(ir).run(); } },
+    { "dce", [](Ir& ir) { return DeadCodeElimination(ir).run(); } },
+};
+
+// Index into k_passes.
+using PassId = size_t;
+
+inline std::optional<PassId> find_pass(const std::string_view name) {
+    for (PassId pass = 0; pass < std::size(k_passes); pass++) {
+        if (k_passes[pass].name == name) {
+            return pass;
+        }
+    }
+    return {};
+}
+
+// What to run for an -O level: -O0 runs nothing, -O1 the pipeline once, and
+// -O2 repeats it until a round of it changes nothing. const-fold runs again
+// after simplify-cfg, which can turn a phi into a constant.
+struct Pipeline {
+    std::vector<PassId> passes;
+    bool to_fixed_point;
+};
+
+inline Pipeline pipeline_for_level(const int level) {
+    if (level == 0) {
+        return { {}, false };
+    }
+    const PassId const_fold = find_pass("const-fold").value();
+    return { { const_fold, find_pass("simplify-cfg").value(), const_fold, find_pass("dce").value() }, level >= 2 };
+}
+
+// Runs passes over an Ir, checking it after each one, and keeps per-pass
+// totals (wall time, instructions added or removed, changes) for --stats.
+class PassManager {
+public:
+    explicit PassManager(Ir& ir) : m_ir(ir) {
+    }
+
+    void run(const Pipeline& pipeline) {
+        for (size_t round = 0; round < k_max_rounds; round++) {
+            size_t changes = 0;
+            for (const PassId pass : pipeline.passes) {
+                changes += run_pass(pass);
+            }
+            if (!pipeline.to_fixed_point || changes == 0) {
+                break;
+            }
+        }
+    }
+
+    void print(std::ostream& out) const {
+        if (m_stats.empty()) {
+            return;
+        }
+        out << "pass           runs       time     insts   changes\n";
+        for (const PassStats& stats : m_stats) {
+            out << std::left << std::setw(14) << k_passes[stats.pass].name << std::right << std::setw(5)
+                << stats.runs << std::fixed << std::setprecision(1) << std::setw(8)
+                << static_cast<double>(stats.time.count()) / 1e6 << " ms" << std::setw(10) << std::showpos
+                << stats.inst_delta << std::noshowpos << std::setw(10) << stats.changes << "\n";
+        }
+    }
+
+private:
+    // -O2 stops here even if the last round changed something.
+    static constexpr size_t k_max_rounds = 16;
+
+    size_t run_pass(const PassId pass) {
+        const auto insts_before = static_cast<std::ptrdiff_t>(m_ir.insts.size());
+        const auto start = std::chrono::steady_clock::now();
+        const size_t changes = k_passes[pass].run(m_ir);
+        const auto time = std::chrono::steady_clock::now() - start;
+        IrVerifier(m_ir).verify();
+
+        PassStats* stats = nullptr;
+        for (PassStats& entry : m_stats) {
+            if (entry.pass == pass) {
+                stats = &entry;
+            }
+        }
+        if (stats == nullptr) {
+            stats = &m_stats.emplace_back(PassStats { pass });
+        }
+        stats->runs++;
+        stats->time += std::chrono::duration_cast<std::chrono::nanoseconds>(time);
+        stats->inst_delta += static_cast<std::ptrdiff_t>(m_ir.insts.size()) - insts_before;
+        stats->changes += changes;
+        return changes;
+    }
+
+    // Totals over every run of one pass.
+    struct PassStats {
+        PassId pass;
+        size_t runs = 0;
+        std::chrono::nanoseconds time {};
+        std::ptrdiff_t inst_delta = 0;
+        size_t changes = 0;
+    };
+
+    Ir& m_ir;
+    // In the order the passes first ran.
+    std::vector<PassStats> m_stats {};
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Resident memory per compiler phase, for --stats. The kernel's peak RSS
+// counter is reset when a phase begins (through /proc/self/clear_refs), so
+// each peak is that phase's own. Where the reset is not allowed, a peak
+// covers the run so far instead.
+//
+// A disabled PhaseStats does nothing, so the phases can be marked
+// unconditionally.
+class PhaseStats {
+public:
+    explicit PhaseStats(const bool enabled) : m_enabled(enabled) {
+    }
+
+    void begin(const std::string_view name) {
+        if (!m_enabled) {
+            return;
+        }
+        std::ofstream("/proc/self/clear_refs") << "5";
+        m_phases.push_back({ std::string(name), 0, 0 });
+    }
+
+    // Ends the phase begun last. What it leaves behind for later phases
+    // should be all that is still resident by now.
+    void end() {
+        if (!m_enabled) {
+            return;
+        }
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.starts_with("VmHWM:")) {
+                m_phases.back().peak_kb = parse_kb(line);
+            }
+            else if (line.starts_with("VmRSS:")) {
+                m_phases.back().after_kb = parse_kb(line);
+            }
+        }
+    }
+
+    void print(std::ostream& out) const {
+        if (!m_enabled) {
+            return;
+        }
+        out << "phase        peak RSS   RSS after\n";
+        for (const Phase& phase : m_phases) {
+            out << std::left << std::setw(10) << phase.name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(9) << static_cast<double>(phase.peak_kb) / 1024 << " MB" << std::setw(9)
+                << static_cast<double>(phase.after_kb) / 1024 << " MB\n";
+        }
+    }
+
+private:
+    struct Phase {
+        std::string name;
+        size_t peak_kb;
+        size_t after_kb;
+    };
+
+    // "VmHWM:\t  1234 kB"
+    static size_t parse_kb(const std::string_view line) {
+        size_t value = 0;
+        for (const char c : line) {
+            if (c >= '0' && c <= '9') {
+                value = value * 10 + static_cast<size_t>(c - '0');
+            }
+        }
+        return value;
+    }
+
+    bool m_enabled;
+    std::vector<Phase> m_phases {};
+};
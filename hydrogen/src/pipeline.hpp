@@ -0,0 +1,292 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "tokenization.hpp"
+
+// Lock-free single-producer/single-consumer ring of token batches. Batches
+// are allocated once up front and recycled, and the producer blocks whenever
+// all of them are in flight, so memory stays bounded by
+// k_depth * batch_size tokens however far ahead the lexer gets. Each side
+// blocks in std::atomic::wait on the other side's counter. Closing and
+// cancelling set the top bit of the counter the other side waits on, so they
+// wake it like any other update.
+class TokenBatchQueue {
+public:
+    static constexpr size_t k_depth = 8;
+
+    explicit TokenBatchQueue(const size_t batch_size) {
+        for (std::vector<Token>& batch : m_batches) {
+            batch.reserve(batch_size);
+        }
+    }
+
+    // Producer side. Returns an empty batch to fill, or nullptr if the
+    // consumer has gone away.
+    std::vector<Token>* acquire() {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        while ((head & k_flag) == 0 && tail - head == k_depth) {
+            m_head.wait(head, std::memory_order_acquire);
+            head = m_head.load(std::memory_order_acquire);
+        }
+        if ((head & k_flag) != 0) {
+            return nullptr;
+        }
+        std::vector<Token>& batch = m_batches[tail % k_depth];
+        batch.clear();
+        return &batch;
+    }
+
+    void publish() {
+        m_tail.fetch_add(1, std::memory_order_release);
+        m_tail.notify_one();
+    }
+
+    // Ends the producer side. This is the only way a lexer failure leaves the
+    // lexer thread; the consumer reports it.
+    void close(const bool failed) {
+        m_failed = failed;
+        m_tail.fetch_or(k_flag, std::memory_order_release);
+        m_tail.notify_one();
+    }
+
+    // Consumer side. Returns the oldest published batch, or nullptr once the
+    // producer has closed the queue and every batch has been consumed.
+    const std::vector<Token>* front() {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        while (head == (tail & ~k_flag)) {
+            if ((tail & k_flag) != 0) {
+                return nullptr;
+            }
+            m_tail.wait(tail, std::memory_order_acquire);
+            tail = m_tail.load(std::memory_order_acquire);
+        }
+        return &m_batches[head % k_depth];
+    }
+
+    void pop() {
+        m_head.fetch_add(1, std::memory_order_release);
+        m_head.notify_one();
+    }
+
+    void cancel() {
+        m_head.fetch_or(k_flag, std::memory_order_release);
+        m_head.notify_one();
+    }
+
+    // Only meaningful after front() returned nullptr.
+    [[nodiscard]] bool failed() const {
+        return m_failed;
+    }
+
+private:
+    // Closed, in m_tail; cancelled, in m_head.
+    static constexpr size_t k_flag = ~(SIZE_MAX >> 1);
+
+    std::array<std::vector<Token>, k_depth> m_batches {};
+    alignas(64) std::atomic<size_t> m_head { 0 };
+    alignas(64) std::atomic<size_t> m_tail { 0 };
+    bool m_failed = false;
+};
+
+// Runs a Tokenizer on its own thread and hands its tokens over in batches, so
+// lexing overlaps with parsing. Plugs into TokenStream like a Tokenizer does.
+// The lexer thread never reports errors; an invalid token closes the queue
+// as failed, and the thread calling next() reports it.
+// The lexer thread interns into `symbols`; nobody else may touch the table
+// until next() has returned false.
+class PipelinedTokenizer {
+public:
+    static constexpr size_t k_default_batch_size = 4096;
+
+    PipelinedTokenizer(const std::string_view src, SymbolTable& symbols, const size_t batch_size)
+        : m_queue(std::make_unique<TokenBatchQueue>(batch_size)) {
+        m_thread = std::thread([src, &symbols, batch_size, queue = m_queue.get()] {
+            Tokenizer tokenizer(src, symbols);
+            bool more = true;
+            while (more) {
+                std::vector<Token>* batch = queue->acquire();
+                if (batch == nullptr) {
+                    return;
+                }
+                Token token {};
+                while (batch->size() < batch_size && (more = tokenizer.next(token))) {
+                    batch->push_back(token);
+                }
+                if (!batch->empty()) {
+                    queue->publish();
+                }
+            }
+            queue->close(tokenizer.failed());
+        });
+    }
+
+    PipelinedTokenizer(PipelinedTokenizer&&) noexcept = default;
+
+    ~PipelinedTokenizer() {
+        if (m_thread.joinable()) {
+            m_queue->cancel();
+            m_thread.join();
+        }
+    }
+
+    bool next(Token& token) {
+        while (m_batch == nullptr || m_batch_idx == m_batch->size()) {
+            if (m_batch != nullptr) {
+                m_queue->pop();
+            }
+            m_batch = m_queue->front();
+            m_batch_idx = 0;
+            if (m_batch == nullptr) {
+                // The lexer thread closed the queue and is about to return.
+                // Joining it here means a caller that reports failed() and
+                // exits has no other thread left running.
+                if (m_thread.joinable()) {
+                    m_thread.join();
+                }
+                m_failed = m_queue->failed();
+                return false;
+            }
+        }
+        token = (*m_batch)[m_batch_idx++];
+        return true;
+    }
+
+    [[nodiscard]] bool failed() const {
+        return m_failed;
+    }
+
+private:
+    std::unique_ptr<TokenBatchQueue> m_queue;
+    std::thread m_thread;
+    const std::vector<Token>* m_batch = nullptr;
+    size_t m_batch_idx = 0;
+    bool m_failed = false;
+};
+
+// Sources smaller than this are not worth splitting across threads.
+inline constexpr size_t k_parallel_tokenize_min_size = 4 * 1024 * 1024;
+
+// Whether the `/` at `idx` opens a comment.
+inline bool starts_comment(const std::string_view src, const size_t idx) {
+    return idx + 1 < src.size() && (src[idx + 1] == '/' || src[idx + 1] == '*');
+}
+
+// Returns the position right after the comment that starts at `idx` (for a
+// line comment, the position of its newline), or idx + 1 if no comment starts
+// there. `src[idx]` must be a `/`.
+inline size_t skip_comment_at(const std::string_view src, const size_t idx) {
+    if (!starts_comment(src, idx)) {
+        return idx + 1;
+    }
+    if (src[idx + 1] == '/') {
+        return k_scan_routines.find_line_end(src, idx + 2);
+    }
+    return std::min(k_scan_routines.find_block_comment_end(src, idx + 2) + 2, src.size());
+}
+
+inline size_t find_slash(const std::string_view src, const size_t begin, const size_t end) {
+    const void* slash = std::memchr(src.data() + begin, '/', end - begin);
+    return slash == nullptr ? end : static_cast<const char*>(slash) - src.data();
+}
+
+// Splits `src` into at most `count` chunks that can be tokenized
+// independently. Returns the chunk start offsets followed by src.size().
+// Chunks start right after a newline that is not inside a block comment; no
+// token spans a newline, so lexing the chunks separately gives the same
+// tokens as lexing the whole source. Finding the boundaries is a pass over
+// the `/` bytes between them, which memchr gets through quickly.
+inline std::vector<size_t> find_chunk_boundaries(const std::string_view src, const size_t count) {
+    std::vector<size_t> bounds { 0 };
+    size_t pos = 0; // Always outside of any comment.
+    for (size_t chunk = 1; chunk < count && pos < src.size(); chunk++) {
+        const size_t target = src.size() / count * chunk;
+        while (pos < target) {
+            const size_t slash = find_slash(src, pos, target);
+            pos = slash == target ? target : skip_comment_at(src, slash);
+        }
+        while (pos < src.size()) {
+            const size_t newline = k_scan_routines.find_line_end(src, pos);
+            size_t slash = find_slash(src, pos, newline);
+            while (slash < newline && !starts_comment(src, slash)) {
+                slash = find_slash(src, slash + 1, newline);
+            }
+            if (slash < newline && src[slash + 1] == '*') {
+                // A block comment opens before the newline; look past it.
+                pos = skip_comment_at(src, slash);
+                continue;
+            }
+            // Either nothing opens before the newline, or a line comment
+            // that the newline ends.
+            pos = std::min(newline + 1, src.size());
+            break;
+        }
+        if (pos < src.size()) {
+            bounds.push_back(pos);
+        }
+    }
+    bounds.push_back(src.size());
+    return bounds;
+}
+
+// Tokenizes `src` on up to `thread_count` threads, one chunk each, and
+// concatenates the per-chunk buffers in source order. Token offsets are
+// relative to the whole source and line numbers are derived from offsets.
+// Each chunk interns into its own table, and the tables are merged into
+// `symbols` in chunk order, so the result (symbol ids included) is identical
+// to Tokenizer::tokenize(). Sources smaller than `min_size` are tokenized on
+// the calling thread.
+inline TokenBuffer tokenize_parallel(const std::string_view src, SymbolTable& symbols, const size_t thread_count,
+    const size_t min_size = k_parallel_tokenize_min_size) {
+    if (thread_count <= 1 || src.size() < min_size) {
+        Tokenizer tokenizer(src, symbols);
+        return tokenizer.tokenize();
+    }
+    if (src.size() > UINT32_MAX) {
+        std::cerr << "Source file too large" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::vector<size_t> bounds = find_chunk_boundaries(src, thread_count);
+    const size_t chunk_count = bounds.size() - 1;
+    std::vector<TokenBuffer> chunks(chunk_count, TokenBuffer(src));
+    std::vector<SymbolTable> chunk_symbols(chunk_count);
+    std::vector<char> ok(chunk_count, false);
+    auto tokenize_chunk = [&](const size_t chunk) {
+        Tokenizer tokenizer(src.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]), chunk_symbols[chunk]);
+        ok[chunk] = tokenizer.tokenize_into(chunks[chunk]);
+    };
+    std::vector<std::thread> workers;
+    for (size_t chunk = 1; chunk < chunk_count; chunk++) {
+        workers.emplace_back(tokenize_chunk, chunk);
+    }
+    tokenize_chunk(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    TokenBuffer tokens(src);
+    size_t total = 0;
+    for (const TokenBuffer& chunk : chunks) {
+        total += chunk.size();
+    }
+    tokens.reserve(total);
+    std::vector<SymbolId> symbol_map;
+    for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+        if (!ok[chunk]) {
+            error_invalid_token();
+        }
+        symbol_map.resize(chunk_symbols[chunk].size());
+        for (SymbolId id = 0; id < symbol_map.size(); id++) {
+            symbol_map[id] = symbols.intern(chunk_symbols[chunk].name(id));
+        }
+        tokens.append(chunks[chunk], symbol_map);
+    }
+    return tokens;
+}
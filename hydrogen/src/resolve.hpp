@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./symbols.hpp"
+
+// Binds every use of a variable to its slot before lowering, and reports
+// undeclared and redeclared names. A variable's slot is the number of
+// variables that were live when it was declared. Slots go into the c field
+// of ident and stmt_assign nodes, so lowering does no name lookups at all.
+//
+// A name cannot be declared again while it is visible, so a symbol has at
+// most one live binding. The scope chain is therefore a table indexed by
+// symbol id, plus the symbols each open scope declared, which are unbound
+// again when it closes. Declaring, looking up and unbinding are O(1)
+// however many variables are live.
+//
+// Names are checked in the order the old stack-machine code generator
+// emitted them (right operand first, a let's variable visible in its own
+// initializer), so a program with several errors reports the same one as
+// it always has.
+class Resolver {
+public:
+    Resolver(const Ast& ast, const SymbolNames symbols)
+        : m_ast(ast)
+        , m_symbols(symbols)
+        , m_bindings(symbols.count, k_unbound) {
+    }
+
+    void resolve() {
+        push_stmts(m_ast.root());
+        while (!m_tasks.empty()) {
+            const Task task = m_tasks.back();
+            m_tasks.pop_back();
+            switch (task.kind) {
+                case TaskKind::stmt:
+                    resolve_stmt(task.node);
+                    break;
+                case TaskKind::if_pred:
+                    resolve_if_pred(task.node);
+                    break;
+                case TaskKind::end_scope:
+                    end_scope();
+                    break;
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint32_t k_unbound = UINT32_MAX;
+
+    void resolve_stmt(const NodeIndex stmt) {
+        AstNode& node = m_ast.nodes[stmt];
+        switch (m_ast.kind(stmt)) {
+            case NodeKind::stmt_exit:
+                resolve_expr(node.a);
+                break;
+            case NodeKind::stmt_let:
+                if (m_bindings[node.a] != k_unbound) {
+                    std::cerr << "Identifier already used: " << m_symbols.name(node.a) << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                m_bindings[node.a] = static_cast<std::uint32_t>(m_declared.size());
+                m_declared.push_back(node.a);
+                resolve_expr(node.b);
+                break;
+            case NodeKind::stmt_assign:
+                node.c = lookup(node.a);
+                resolve_expr(node.b);
+                break;
+            case NodeKind::scope:
+                push_scope(stmt);
+                break;
+            case NodeKind::stmt_if:
+                resolve_expr(node.a);
+                if (node.c != k_no_node) {
+                    m_tasks.push_back({ TaskKind::if_pred, node.c });
+                }
+                push_scope(node.b);
+                break;
+            default:
+                assert(false); // Unreachable;
+        }
+    }
+
+    void resolve_if_pred(const NodeIndex pred) {
+        const AstNode& node = m_ast.node(pred);
+        if (m_ast.kind(pred) == NodeKind::pred_elif) {
+            resolve_expr(node.a);
+            if (node.c != k_no_node) {
+                m_tasks.push_back({ TaskKind::if_pred, node.c });
+            }
+            push_scope(node.b);
+        }
+        else {
+            push_scope(node.a);
+        }
+    }
+
+    // The right operand's subtree before the left one's.
+    void resolve_expr(const NodeIndex expr) {
+        m_exprs.push_back(expr);
+        while (!m_exprs.empty()) {
+            const NodeIndex idx = m_exprs.back();
+            m_exprs.pop_back();
+            AstNode& node = m_ast.nodes[idx];
+            if (m_ast.kind(idx) == NodeKind::ident) {
+                node.c = lookup(node.a);
+            }
+            else if (is_bin_expr(m_ast.kind(idx))) {
+                m_exprs.push_back(node.a);
+                m_exprs.push_back(node.b);
+            }
+        }
+    }
+
+    [[nodiscard]] std::uint32_t lookup(const SymbolId symbol) const {
+        const std::uint32_t slot = m_bindings[symbol];
+        if (slot == k_unbound) {
+            std::cerr << "Undeclared identifier: " << m_symbols.name(symbol) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return slot;
+    }
+
+    // Schedules the statements of `list`, first statement on top.
+    void push_stmts(const NodeIndex list) {
+        const ArenaSpan<NodeIndex> stmts = m_ast.stmts(list);
+        for (size_t idx = stmts.size; idx > 0; idx--) {
+            m_tasks.push_back({ TaskKind::stmt, stmts[idx - 1] });
+        }
+    }
+
+    void push_scope(const NodeIndex scope) {
+        m_scopes.push_back(m_declared.size());
+        m_tasks.push_back({ TaskKind::end_scope, scope });
+        push_stmts(scope);
+    }
+
+    void end_scope() {
+        while (m_declared.size() > m_scopes.back()) {
+            m_bindings[m_declared.back()] = k_unbound;
+            m_declared.pop_back();
+        }
+        m_scopes.pop_back();
+    }
+
+    enum class TaskKind : std::uint8_t {
+        stmt,
+        // An elif or else.
+        if_pred,
+        end_scope,
+    };
+
+    struct Task {
+        TaskKind kind;
+        NodeIndex node;
+    };
+
+    const Ast m_ast;
+    const SymbolNames m_symbols;
+    // Slot per symbol, or k_unbound.
+    std::vector<std::uint32_t> m_bindings;
+    // The live variables' symbols, in slot order.
+    std::vector<SymbolId> m_declared {};
+    // m_declared.size() when each open scope began.
+    std::vector<size_t> m_scopes {};
+    std::vector<NodeIndex> m_exprs {};
+    std::vector<Task> m_tasks {};
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Skip routines for the long runs that make up most generated sources:
+// indentation, comment bodies and identifiers. Each one takes the source and
+// a start index and returns the index of the first byte that is not part of
+// the run (or the end of the source). The byte sets have to agree with
+// k_char_classes in tokenization.hpp.
+//
+// SSE2 is the baseline on x86-64. The AVX2 versions are selected once at
+// startup from cpuid; other targets use the scalar loops.
+
+inline bool is_space_byte(const char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool is_alnum_byte(const char c) {
+    const char lower = static_cast<char>(c | 0x20);
+    return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9');
+}
+
+inline size_t skip_space_scalar(const std::string_view src, size_t idx) {
+    while (idx < src.size() && is_space_byte(src[idx])) {
+        idx++;
+    }
+    return idx;
+}
+
+inline size_t skip_alnum_scalar(const std::string_view src, size_t idx) {
+    while (idx < src.size() && is_alnum_byte(src[idx])) {
+        idx++;
+    }
+    return idx;
+}
+
+inline size_t find_line_end_scalar(const std::string_view src, size_t idx) {
+    while (idx < src.size() && src[idx] != '\n') {
+        idx++;
+    }
+    return idx;
+}
+
+// Returns the index of the `*` of the first `*/` at or after `idx`.
+inline size_t find_block_comment_end_scalar(const std::string_view src, size_t idx) {
+    while (idx + 1 < src.size() && !(src[idx] == '*' && src[idx + 1] == '/')) {
+        idx++;
+    }
+    return idx + 1 < src.size() ? idx : src.size();
+}
+
+#if defined(__x86_64__)
+
+inline std::uint32_t space_mask_sse2(const __m128i bytes) {
+    const __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    const __m128i ctrl = _mm_and_si128(
+        _mm_cmpgt_epi8(bytes, _mm_set1_epi8('\t' - 1)),
+        _mm_cmpgt_epi8(_mm_set1_epi8('\r' + 1), bytes));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(space, ctrl)));
+}
+
+inline std::uint32_t alnum_mask_sse2(const __m128i bytes) {
+    const __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    const __m128i alpha = _mm_and_si128(
+        _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+        _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+    const __m128i digit = _mm_and_si128(
+        _mm_cmpgt_epi8(bytes, _mm_set1_epi8('0' - 1)),
+        _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), bytes));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(alpha, digit)));
+}
+
+inline __m128i load_sse2(const std::string_view src, const size_t idx) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data() + idx));
+}
+
+inline size_t skip_space_sse2(const std::string_view src, size_t idx) {
+    for (; idx + 16 <= src.size(); idx += 16) {
+        const std::uint32_t other = ~space_mask_sse2(load_sse2(src, idx)) & 0xFFFF;
+        if (other != 0) {
+            return idx + std::countr_zero(other);
+        }
+    }
+    return skip_space_scalar(src, idx);
+}
+
+inline size_t skip_alnum_sse2(const std::string_view src, size_t idx) {
+    for (; idx + 16 <= src.size(); idx += 16) {
+        const std::uint32_t other = ~alnum_mask_sse2(load_sse2(src, idx)) & 0xFFFF;
+        if (other != 0) {
+            return idx + std::countr_zero(other);
+        }
+    }
+    return skip_alnum_scalar(src, idx);
+}
+
+inline size_t find_line_end_sse2(const std::string_view src, size_t idx) {
+    for (; idx + 16 <= src.size(); idx += 16) {
+        const auto newline = static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(load_sse2(src, idx), _mm_set1_epi8('\n'))));
+        if (newline != 0) {
+            return idx + std::countr_zero(newline);
+        }
+    }
+    return find_line_end_scalar(src, idx);
+}
+
+inline size_t find_block_comment_end_sse2(const std::string_view src, size_t idx) {
+    for (; idx + 17 <= src.size(); idx += 16) {
+        const auto star = static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(load_sse2(src, idx), _mm_set1_epi8('*'))));
+        const auto slash = static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(load_sse2(src, idx + 1), _mm_set1_epi8('/'))));
+        if ((star & slash) != 0) {
+            return idx + std::countr_zero(star & slash);
+        }
+    }
+    return find_block_comment_end_scalar(src, idx);
+}
+
+__attribute__((target("avx2"))) inline std::uint32_t space_mask_avx2(const __m256i bytes) {
+    const __m256i space = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    const __m256i ctrl = _mm256_and_si256(
+        _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('\t' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), bytes));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(space, ctrl)));
+}
+
+__attribute__((target("avx2"))) inline std::uint32_t alnum_mask_avx2(const __m256i bytes) {
+    const __m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+    const __m256i alpha = _mm256_and_si256(
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    const __m256i digit = _mm256_and_si256(
+        _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), bytes));
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(alpha, digit)));
+}
+
+__attribute__((target("avx2"))) inline __m256i load_avx2(const std::string_view src, const size_t idx) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.data() + idx));
+}
+
+__attribute__((target("avx2"))) inline size_t skip_space_avx2(const std::string_view src, size_t idx) {
+    for (; idx + 32 <= src.size(); idx += 32) {
+        const std::uint32_t other = ~space_mask_avx2(load_avx2(src, idx));
+        if (other != 0) {
+            return idx + std::countr_zero(other);
+        }
+    }
+    return skip_space_sse2(src, idx);
+}
+
+__attribute__((target("avx2"))) inline size_t skip_alnum_avx2(const std::string_view src, size_t idx) {
+    for (; idx + 32 <= src.size(); idx += 32) {
+        const std::uint32_t other = ~alnum_mask_avx2(load_avx2(src, idx));
+        if (other != 0) {
+            return idx + std::countr_zero(other);
+        }
+    }
+    return skip_alnum_sse2(src, idx);
+}
+
+__attribute__((target("avx2"))) inline size_t find_line_end_avx2(const std::string_view src, size_t idx) {
+    for (; idx + 32 <= src.size(); idx += 32) {
+        const auto newline = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(load_avx2(src, idx), _mm256_set1_epi8('\n'))));
+        if (newline != 0) {
+            return idx + std::countr_zero(newline);
+        }
+    }
+    return find_line_end_sse2(src, idx);
+}
+
+__attribute__((target("avx2"))) inline size_t find_block_comment_end_avx2(const std::string_view src, size_t idx) {
+    for (; idx + 33 <= src.size(); idx += 32) {
+        const auto star = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(load_avx2(src, idx), _mm256_set1_epi8('*'))));
+        const auto slash = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(load_avx2(src, idx + 1), _mm256_set1_epi8('/'))));
+        if ((star & slash) != 0) {
+            return idx + std::countr_zero(star & slash);
+        }
+    }
+    return find_block_comment_end_sse2(src, idx);
+}
+
+#endif
+
+struct ScanRoutines {
+    size_t (*skip_space)(std::string_view src, size_t idx);
+    size_t (*skip_alnum)(std::string_view src, size_t idx);
+    size_t (*find_line_end)(std::string_view src, size_t idx);
+    size_t (*find_block_comment_end)(std::string_view src, size_t idx);
+};
+
+inline ScanRoutines select_scan_routines() {
+#if defined(__x86_64__)
+    // __builtin_cpu_supports reads the cpuid feature bits (and checks that the
+    // OS saves the AVX state) once per process.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { skip_space_avx2, skip_alnum_avx2, find_line_end_avx2, find_block_comment_end_avx2 };
+    }
+    return { skip_space_sse2, skip_alnum_sse2, find_line_end_sse2, find_block_comment_end_sse2 };
+#else
+    return { skip_space_scalar, skip_alnum_scalar, find_line_end_scalar, find_block_comment_end_scalar };
+#endif
+}
+
+inline const ScanRoutines k_scan_routines = select_scan_routines();
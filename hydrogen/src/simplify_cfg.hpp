@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+#include "./ir.hpp"
+
+// Tidies the control-flow graph:
+//
+// - A branch on a constant becomes a jump, and blocks that can no longer be
+//   reached go.
+// - A phi whose incoming values are all the same value is replaced by it.
+// - A block whose only predecessor comes right before it and jumps to it is
+//   appended to that predecessor.
+class SimplifyCfg {
+public:
+    explicit SimplifyCfg(Ir& ir) : m_ir(ir) {
+    }
+
+    // Returns the number of branches, phis and blocks simplified.
+    size_t run() {
+        size_t changes = 0;
+        for (BlockId block = 0; block < m_ir.blocks.size(); block++) {
+            const ValueId last = m_ir.blocks[block].end - 1;
+            IrInst& fields = m_ir.insts[last];
+            if (m_ir.ops[last] == IrOp::branch && m_ir.ops[fields.a] == IrOp::const_) {
+                fields = { m_ir.const_value(fields.a) != 0 ? fields.b : fields.c, 0, 0 };
+                m_ir.ops[last] = IrOp::jump;
+                changes++;
+            }
+        }
+        if (changes > 0) {
+            IrEditor(m_ir).commit();
+        }
+
+        IrEditor editor(m_ir);
+        size_t edits = 0;
+        for (ValueId inst = 0; inst < m_ir.insts.size(); inst++) {
+            if (m_ir.ops[inst] != IrOp::phi) {
+                continue;
+            }
+            const IrInst& fields = m_ir.insts[inst];
+            const ValueId value = editor.current(m_ir.phi_args[fields.a].value);
+            bool same = true;
+            for (std::uint32_t idx = fields.a + 1; idx < fields.a + fields.b; idx++) {
+                same = same && editor.current(m_ir.phi_args[idx].value) == value;
+            }
+            if (same) {
+                editor.replace(inst, value);
+                edits++;
+            }
+        }
+        for (BlockId block = 1; block < m_ir.blocks.size(); block++) {
+            const std::uint32_t begin = m_ir.pred_begin[block];
+            if (m_ir.pred_begin[block + 1] - begin == 1 && m_ir.preds[begin] == block - 1
+                && m_ir.terminator(block - 1) == IrOp::jump) {
+                editor.remove(m_ir.blocks[block - 1].end - 1);
+                editor.merge_into_prev(block);
+                edits++;
+            }
+        }
+        if (edits > 0) {
+            editor.commit();
+        }
+        return changes + edits;
+    }
+
+private:
+    Ir& m_ir;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only contents of an input file. Regular files are memory-mapped, so
+// the tokenizer works directly on the mapped pages with no copy in between.
+// Pipes, terminals and stdin (`-`) are read into a buffer instead.
+class SourceFile {
+public:
+    explicit SourceFile(const std::string& path) {
+        const int fd = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Could not open " << path << ": " << std::strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            const auto size = static_cast<size_t>(info.st_size);
+            void* const map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, size, MADV_SEQUENTIAL);
+                m_map = map;
+                m_size = size;
+            }
+        }
+        if (m_map == nullptr) {
+            read_all(fd, path);
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    SourceFile(SourceFile&& other) noexcept
+        : m_map { std::exchange(other.m_map, nullptr) }
+        , m_size { std::exchange(other.m_size, 0) }
+        , m_buffer { std::move(other.m_buffer) } {
+    }
+
+    ~SourceFile() {
+        if (m_map != nullptr) {
+            munmap(m_map, m_size);
+        }
+    }
+
+    [[nodiscard]] std::string_view view() const {
+        if (m_map != nullptr) {
+            return { static_cast<const char*>(m_map), m_size };
+        }
+        return m_buffer;
+    }
+
+private:
+    void read_all(const int fd, const std::string& path) {
+        char chunk[64 * 1024];
+        while (true) {
+            const ssize_t count = read(fd, chunk, sizeof(chunk));
+            if (count == 0) {
+                break;
+            }
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Could not read " << path << ": " << std::strerror(errno) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            m_buffer.append(chunk, static_cast<size_t>(count));
+        }
+    }
+
+    void* m_map = nullptr;
+    size_t m_size = 0;
+    std::string m_buffer;
+};
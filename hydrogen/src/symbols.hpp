@@ -0,0 +1,123 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+using SymbolId = std::uint32_t;
+
+// Read-only view of interned names: name `id` is chars[offsets[id]] up to the
+// next name's offset (or chars_size, for the last one). Backed by either a
+// SymbolTable or the name section of an AST cache file.
+struct SymbolNames {
+    const std::uint32_t* offsets;
+    const char* chars;
+    size_t count;
+    size_t chars_size;
+
+    [[nodiscard]] std::string_view name(const SymbolId id) const {
+        const size_t end = id + 1 < count ? offsets[id + 1] : chars_size;
+        return { chars + offsets[id], end - offsets[id] };
+    }
+};
+
+// Interns identifier spellings into dense ids (0, 1, 2, ... in order of first
+// appearance). Each unique name is copied into the table once, so names stay
+// valid after the source buffer is gone, and everything past the tokenizer
+// compares and indexes names as integers.
+class SymbolTable {
+public:
+    SymbolTable() : m_slots(k_initial_slots, Slot { 0, k_empty }) {
+    }
+
+    SymbolId intern(const std::string_view name) {
+        const std::uint64_t hash = hash_name(name);
+        const auto tag = static_cast<std::uint32_t>(hash >> 32);
+        size_t slot = hash & (m_slots.size() - 1);
+        while (m_slots[slot].id != k_empty) {
+            // Only touch the name storage when the cached hash bits agree.
+            if (m_slots[slot].tag == tag && this->name(m_slots[slot].id) == name) {
+                return m_slots[slot].id;
+            }
+            slot = (slot + 1) & (m_slots.size() - 1);
+        }
+        const auto id = static_cast<SymbolId>(m_hashes.size());
+        m_slots[slot] = { tag, id };
+        m_hashes.push_back(hash);
+        m_offsets.push_back(static_cast<std::uint32_t>(m_chars.size()));
+        m_chars.insert(m_chars.end(), name.begin(), name.end());
+        if (m_hashes.size() * 2 > m_slots.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    // The view is invalidated by the next intern() of a new name.
+    [[nodiscard]] std::string_view name(const SymbolId id) const {
+        return names().name(id);
+    }
+
+    // Invalidated the same way.
+    [[nodiscard]] SymbolNames names() const {
+        return { m_offsets.data(), m_chars.data(), m_offsets.size(), m_chars.size() };
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_offsets.size();
+    }
+
+    // Frees the lookup index once all names are in. Only name() and names()
+    // may be used afterwards.
+    void seal() {
+        m_slots = {};
+        m_hashes = {};
+    }
+
+private:
+    static constexpr SymbolId k_empty = UINT32_MAX;
+    static constexpr size_t k_initial_slots = 256;
+
+    // Word-at-a-time multiplicative hash; identifiers in generated sources
+    // tend to be long.
+    static std::uint64_t hash_name(const std::string_view name) {
+        std::uint64_t hash = name.size() * 0x9E3779B97F4A7C15ull;
+        size_t idx = 0;
+        for (; idx + 8 <= name.size(); idx += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, name.data() + idx, 8);
+            hash = std::rotl((hash ^ word) * 0xBF58476D1CE4E5B9ull, 31);
+        }
+        if (idx < name.size()) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, name.data() + idx, name.size() - idx);
+            hash = std::rotl((hash ^ word) * 0xBF58476D1CE4E5B9ull, 31);
+        }
+        return hash ^ (hash >> 29);
+    }
+
+    void grow() {
+        m_slots.assign(m_slots.size() * 2, Slot { 0, k_empty });
+        for (SymbolId id = 0; id < m_hashes.size(); id++) {
+            size_t slot = m_hashes[id] & (m_slots.size() - 1);
+            while (m_slots[slot].id != k_empty) {
+                slot = (slot + 1) & (m_slots.size() - 1);
+            }
+            m_slots[slot] = { static_cast<std::uint32_t>(m_hashes[id] >> 32), id };
+        }
+    }
+
+    // Open addressing with linear probing. Each slot caches the upper hash
+    // bits next to the id, so probing past other names stays inside the slot
+    // array.
+    struct Slot {
+        std::uint32_t tag;
+        SymbolId id;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<std::uint64_t> m_hashes {};
+    std::vector<std::uint32_t> m_offsets {};
+    std::vector<char> m_chars {};
+};
@@ -1,9 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum class TokenType {
+#include "scan.hpp"
+#include "symbols.hpp"
+
+enum class TokenType : std::uint8_t {
     exit,
     int_lit,
     semi,
@@ -23,15 +32,7 @@ enum class TokenType {
     else_,
 };
 
-bool is_bin_op(TokenType type) {
-    switch (type) {
-        case TokenType::plus:
-        case TokenType::star:
-            return true;
-        default:
-            return false;
-    }
-}
+inline constexpr size_t k_token_type_count = static_cast<size_t>(TokenType::else_) + 1;
 
 inline std::string to_string(const TokenType type) {
     switch (type) {
@@ -71,164 +72,575 @@ inline std::string to_string(const TokenType type) {
     assert(false);
 }
 
-inline std::optional<int> bin_prec(const TokenType type) {
-    switch (type) {
-        case TokenType::plus:
-        case TokenType::minus:
-            return 0;
-        case TokenType::star:
-        case TokenType::fslash:
-            return 1;
-        default:
-            return {};
-    }
-}
-
+// A single token as handed out by TokenBuffer. `value` is the span of source
+// text the token covers, so the source has to outlive every token (and every
+// node built from one). Identifiers also carry their interned symbol, which
+// is what everything after the tokenizer compares.
 struct Token {
     TokenType type;
-    int line;
-    std::optional<std::string> value {};
+    std::string_view value;
+    SymbolId symbol = 0;
 };
 
-class Tokenizer {
+// Maps source offsets to 1-based line numbers. Only diagnostics need lines,
+// so the newline index is built the first time one is asked for and then
+// searched with a binary search.
+class LineIndex {
 public:
-    explicit Tokenizer(std::string src) : m_src(std::move(src)) {
-    }
-
-    std::vector<Token> tokenize() {
-        std::vector<Token> tokens;
-        std::string buf;
-        int line_count = 1;
-        while(peek().has_value()) {
-            if (std::isalpha(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isalnum(peek().value())) {
-                    buf.push_back(consume());
-                }
-                if (buf == "exit") {
-                    tokens.push_back({ TokenType::exit, line_count });
-                    buf.clear();
-                }
-                else if (buf == "let") {
-                    tokens.push_back({ TokenType::let, line_count  });
-                    buf.clear();
-                }
-                else if (buf == "if") {
-                    tokens.push_back({ TokenType::if_, line_count  });
-                    buf.clear();
-                }
-                else if (buf == "elif") {
-                    tokens.push_back({ TokenType::elif, line_count  });
-                    buf.clear();
-                }
-                else if (buf == "else") {
-                    tokens.push_back({ TokenType::else_, line_count  });
-                    buf.clear();
-                }
-                else {
-                    tokens.push_back({ TokenType::ident, line_count, buf });
-                    buf.clear();
-                }
-            }
-            else if (std::isdigit(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume());
-                }
-                tokens.push_back({ TokenType::int_lit, line_count, buf });
-                buf.clear();
-            }
-            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                consume();
-                consume();
-                while (peek().has_value() && peek().value() != '\n') {
-                    consume();
-                }
-            }
-            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
-                consume();
-                consume();
-                while (peek().has_value()) {
-                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                        break;
-                    }
-                    consume();
-                }
-                if (peek().has_value()) {
-                    consume();
-                }
-                if (peek().has_value()) {
-                    consume();
-                }
-            }
-            else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({ TokenType::open_paren, line_count });
-            }
-            else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({ TokenType::close_paren, line_count });
-            }
-            else if (peek().value() == ';') {
-                consume();
-                tokens.push_back({ TokenType::semi, line_count });
-            }
-            else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({ TokenType::eq, line_count });
-            }
-            else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({ TokenType::plus, line_count });
-            }
-            else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({ TokenType::star, line_count });
-            }
-            else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({ TokenType::minus, line_count });
-            }
-            else if (peek().value() == '/') {
-                consume();
-                tokens.push_back({ TokenType::fslash, line_count });
-            }
-            else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({ TokenType::open_curly, line_count });
-            }
-            else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({ TokenType::close_curly, line_count });
+    explicit LineIndex(const std::string_view src) : m_src(src) {
+    }
+
+    [[nodiscard]] int line_of(const size_t offset) const {
+        if (!m_indexed) {
+            for (size_t idx = k_scan_routines.find_line_end(m_src, 0); idx < m_src.size();
+                 idx = k_scan_routines.find_line_end(m_src, idx + 1)) {
+                m_newlines.push_back(idx);
             }
-            else if (peek().value() == '\n') {
-                consume();
-                line_count++;
+            m_indexed = true;
+        }
+        const auto it = std::ranges::upper_bound(m_newlines, offset);
+        return static_cast<int>(it - m_newlines.cbegin()) + 1;
+    }
+
+private:
+    std::string_view m_src;
+    mutable std::vector<size_t> m_newlines {};
+    mutable bool m_indexed = false;
+};
+
+// Struct-of-arrays token storage: one byte of kind plus two 32-bit words per
+// token, the source offset and a value. The value is the span length, except
+// for identifiers, where it is the symbol id (their length is that of the
+// alphanumeric run at the offset). Tokens are materialized on demand, and line
+// numbers are looked up through the LineIndex only when a diagnostic needs one.
+class TokenBuffer {
+public:
+    explicit TokenBuffer(const std::string_view src) : m_src(src), m_lines(src) {
+    }
+
+    // `token.value` has to point into this buffer's source.
+    void push_back(const Token& token) {
+        m_types.push_back(token.type);
+        m_offsets.push_back(static_cast<std::uint32_t>(token.value.data() - m_src.data()));
+        m_values.push_back(token.type == TokenType::ident ? token.symbol : static_cast<std::uint32_t>(token.value.size()));
+    }
+
+    // Appends `other`, whose identifiers were interned into a different table;
+    // `symbol_map` translates its symbol ids into ours.
+    void append(const TokenBuffer& other, const std::vector<SymbolId>& symbol_map) {
+        m_types.insert(m_types.end(), other.m_types.begin(), other.m_types.end());
+        m_offsets.insert(m_offsets.end(), other.m_offsets.begin(), other.m_offsets.end());
+        for (size_t idx = 0; idx < other.size(); idx++) {
+            const std::uint32_t value = other.m_values[idx];
+            m_values.push_back(other.m_types[idx] == TokenType::ident ? symbol_map[value] : value);
+        }
+    }
+
+    void reserve(const size_t count) {
+        m_types.reserve(count);
+        m_offsets.reserve(count);
+        m_values.reserve(count);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_types.size();
+    }
+
+    [[nodiscard]] bool has(const size_t idx) const {
+        return idx < m_types.size();
+    }
+
+    [[nodiscard]] TokenType type(const size_t idx) const {
+        return m_types[idx];
+    }
+
+    [[nodiscard]] std::string_view text(const size_t idx) const {
+        if (m_types[idx] == TokenType::ident) {
+            return m_src.substr(m_offsets[idx], k_scan_routines.skip_alnum(m_src, m_offsets[idx]) - m_offsets[idx]);
+        }
+        return m_src.substr(m_offsets[idx], m_values[idx]);
+    }
+
+    [[nodiscard]] Token at(const size_t idx) const {
+        const bool ident = m_types[idx] == TokenType::ident;
+        return { m_types[idx], text(idx), ident ? m_values[idx] : 0 };
+    }
+
+    [[nodiscard]] std::uint32_t offset(const size_t idx) const {
+        return m_offsets[idx];
+    }
+
+    [[nodiscard]] int line(const size_t idx) const {
+        return m_lines.line_of(m_offsets[idx]);
+    }
+
+    [[nodiscard]] std::string_view src() const {
+        return m_src;
+    }
+
+private:
+    std::string_view m_src;
+    std::vector<TokenType> m_types {};
+    std::vector<std::uint32_t> m_offsets {};
+    std::vector<std::uint32_t> m_values {};
+    LineIndex m_lines;
+};
+
+// Tokens [begin, end) of a TokenBuffer, indexed from 0, for parsing part of
+// a program. Offsets and lines stay those of the whole source.
+class TokenBufferView {
+public:
+    TokenBufferView(const TokenBuffer& tokens, const size_t begin, const size_t end)
+        : m_tokens(&tokens)
+        , m_begin(begin)
+        , m_end(end) {
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_end - m_begin;
+    }
+
+    [[nodiscard]] bool has(const size_t idx) const {
+        return idx < m_end - m_begin;
+    }
+
+    [[nodiscard]] TokenType type(const size_t idx) const {
+        return m_tokens->type(m_begin + idx);
+    }
+
+    [[nodiscard]] Token at(const size_t idx) const {
+        return m_tokens->at(m_begin + idx);
+    }
+
+    [[nodiscard]] std::uint32_t offset(const size_t idx) const {
+        return m_tokens->offset(m_begin + idx);
+    }
+
+    [[nodiscard]] int line(const size_t idx) const {
+        return m_tokens->line(m_begin + idx);
+    }
+
+private:
+    const TokenBuffer* m_tokens;
+    size_t m_begin;
+    size_t m_end;
+};
+
+// Every token that is spelled literally in the source. The character-class
+// table and the lexer DFA below are derived from this list at compile time.
+struct TokenSpelling {
+    TokenType type;
+    std::string_view text;
+};
+
+inline constexpr TokenSpelling k_token_spellings[] = {
+    { TokenType::exit, "exit" },
+    { TokenType::let, "let" },
+    { TokenType::if_, "if" },
+    { TokenType::elif, "elif" },
+    { TokenType::else_, "else" },
+    { TokenType::semi, ";" },
+    { TokenType::open_paren, "(" },
+    { TokenType::close_paren, ")" },
+    { TokenType::eq, "=" },
+    { TokenType::plus, "+" },
+    { TokenType::star, "*" },
+    { TokenType::minus, "-" },
+    { TokenType::fslash, "/" },
+    { TokenType::open_curly, "{" },
+    { TokenType::close_curly, "}" },
+};
+
+// Keywords are recognized through a perfect hash over the keyword spellings.
+// The multiplier is searched for at compile time so that no two keywords
+// share a slot; classifying a word then costs one hash, one table probe and
+// one length-checked compare however many keywords the language has.
+constexpr bool is_keyword(const TokenSpelling& spelling) {
+    const char first = spelling.text[0];
+    return (first >= 'a' && first <= 'z') || (first >= 'A' && first <= 'Z');
+}
+
+inline constexpr size_t k_keyword_count = [] {
+    size_t count = 0;
+    for (const auto& spelling : k_token_spellings) {
+        if (is_keyword(spelling)) {
+            count++;
+        }
+    }
+    return count;
+}();
+
+inline constexpr unsigned k_keyword_table_bits = std::bit_width(k_keyword_count * 2 - 1);
+
+constexpr std::uint32_t keyword_hash(const std::string_view word, const std::uint32_t seed) {
+    const std::uint32_t key = static_cast<unsigned char>(word.front())
+        | static_cast<unsigned char>(word[word.size() / 2]) << 8
+        | static_cast<unsigned char>(word.back()) << 16
+        | static_cast<std::uint32_t>(word.size()) << 24;
+    return (key * seed) >> (32 - k_keyword_table_bits);
+}
+
+struct KeywordTable {
+    std::uint32_t seed = 0;
+    std::array<TokenSpelling, size_t { 1 } << k_keyword_table_bits> slots {};
+};
+
+inline constexpr KeywordTable k_keywords = [] {
+    for (std::uint32_t seed = 1; seed < (1u << 24); seed += 2) {
+        KeywordTable table { .seed = seed };
+        bool collision = false;
+        for (const auto& spelling : k_token_spellings) {
+            if (!is_keyword(spelling)) {
+                continue;
             }
-            else if (std::isspace(peek().value())) {
-                consume();
+            TokenSpelling& slot = table.slots[keyword_hash(spelling.text, seed)];
+            if (!slot.text.empty()) {
+                collision = true;
+                break;
             }
-            else {
-                std::cerr << "Invalid token" << std::endl;
-                exit(EXIT_FAILURE);
+            slot = spelling;
+        }
+        if (!collision) {
+            return table;
+        }
+    }
+    throw "no perfect hash for the keyword set";
+}();
+
+inline TokenType classify_word(const std::string_view word) {
+    const TokenSpelling& slot = k_keywords.slots[keyword_hash(word, k_keywords.seed)];
+    return slot.text == word ? slot.type : TokenType::ident;
+}
+
+enum class CharClass : std::uint8_t {
+    invalid,
+    space,
+    newline,
+    alpha,
+    digit,
+    punct,
+    // `/` and `*` are single-character tokens too, but they also open and
+    // close comments, so the DFA needs to tell them apart.
+    slash,
+    star,
+    count,
+};
+
+inline constexpr std::array<CharClass, 256> k_char_classes = [] {
+    std::array<CharClass, 256> classes {};
+    for (const char c : std::string_view(" \t\r\v\f")) {
+        classes[static_cast<unsigned char>(c)] = CharClass::space;
+    }
+    classes['\n'] = CharClass::newline;
+    for (int c = 'a'; c <= 'z'; c++) {
+        classes[c] = CharClass::alpha;
+        classes[c - 'a' + 'A'] = CharClass::alpha;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        classes[c] = CharClass::digit;
+    }
+    for (const auto& [type, text] : k_token_spellings) {
+        if (text.size() == 1) {
+            classes[static_cast<unsigned char>(text[0])] = CharClass::punct;
+        }
+    }
+    classes['/'] = CharClass::slash;
+    classes['*'] = CharClass::star;
+    return classes;
+}();
+
+inline constexpr std::array<TokenType, 256> k_single_char_tokens = [] {
+    std::array<TokenType, 256> types {};
+    for (const auto& [type, text] : k_token_spellings) {
+        if (text.size() == 1) {
+            types[static_cast<unsigned char>(text[0])] = type;
+        }
+    }
+    return types;
+}();
+
+enum class LexState : std::uint8_t {
+    start,
+    ident,
+    int_lit,
+    slash,
+    line_comment,
+    block_comment,
+    block_comment_star,
+    count,
+};
+
+enum class LexAction : std::uint8_t {
+    // The byte extends whatever the DFA is currently in.
+    none,
+    // A multi-byte token starts at this byte. Its remaining bytes are skipped
+    // like a `skip` run.
+    begin,
+    // The byte starts a run (whitespace, a comment body, ...) that the scan
+    // routine for the next state skips in one go.
+    skip,
+    // The byte is a complete token on its own.
+    single,
+    // The current token ended right before this byte, which is looked at again
+    // from the start state on the next call.
+    finish,
+    invalid,
+};
+
+struct LexStep {
+    LexState next;
+    LexAction action;
+};
+
+using LexTable = std::array<std::array<LexStep, static_cast<size_t>(CharClass::count)>, static_cast<size_t>(LexState::count)>;
+
+inline constexpr LexTable k_lex_dfa = [] {
+    LexTable table {};
+    for (size_t cls_idx = 0; cls_idx < static_cast<size_t>(CharClass::count); cls_idx++) {
+        const auto cls = static_cast<CharClass>(cls_idx);
+        auto step = [&](const LexState state) -> LexStep& {
+            return table[static_cast<size_t>(state)][cls_idx];
+        };
+        switch (cls) {
+            case CharClass::space:
+            case CharClass::newline:
+                step(LexState::start) = { LexState::start, LexAction::skip };
+                break;
+            case CharClass::alpha:
+                step(LexState::start) = { LexState::ident, LexAction::begin };
+                break;
+            case CharClass::digit:
+                step(LexState::start) = { LexState::int_lit, LexAction::begin };
+                break;
+            case CharClass::slash:
+                step(LexState::start) = { LexState::slash, LexAction::begin };
+                break;
+            case CharClass::punct:
+            case CharClass::star:
+                step(LexState::start) = { LexState::start, LexAction::single };
+                break;
+            default:
+                step(LexState::start) = { LexState::start, LexAction::invalid };
+                break;
+        }
+        const bool alnum = cls == CharClass::alpha || cls == CharClass::digit;
+        step(LexState::ident) = alnum ? LexStep { LexState::ident, LexAction::none } : LexStep { LexState::start, LexAction::finish };
+        step(LexState::int_lit) = cls == CharClass::digit ? LexStep { LexState::int_lit, LexAction::none } : LexStep { LexState::start, LexAction::finish };
+        if (cls == CharClass::slash) {
+            step(LexState::slash) = { LexState::line_comment, LexAction::skip };
+        }
+        else if (cls == CharClass::star) {
+            step(LexState::slash) = { LexState::block_comment, LexAction::skip };
+        }
+        else {
+            step(LexState::slash) = { LexState::start, LexAction::finish };
+        }
+        step(LexState::line_comment) = { cls == CharClass::newline ? LexState::start : LexState::line_comment, LexAction::none };
+        step(LexState::block_comment) = { cls == CharClass::star ? LexState::block_comment_star : LexState::block_comment, LexAction::none };
+        if (cls == CharClass::slash) {
+            step(LexState::block_comment_star) = { LexState::start, LexAction::none };
+        }
+        else if (cls == CharClass::star) {
+            step(LexState::block_comment_star) = { LexState::block_comment_star, LexAction::none };
+        }
+        else {
+            step(LexState::block_comment_star) = { LexState::block_comment, LexAction::skip };
+        }
+    }
+    return table;
+}();
+
+// Kind of the token that ends when the DFA leaves `state` through a `finish`
+// step (or hits the end of the input).
+inline constexpr std::array<TokenType, static_cast<size_t>(LexState::count)> k_state_tokens = [] {
+    std::array<TokenType, static_cast<size_t>(LexState::count)> types {};
+    types[static_cast<size_t>(LexState::ident)] = TokenType::ident;
+    types[static_cast<size_t>(LexState::int_lit)] = TokenType::int_lit;
+    types[static_cast<size_t>(LexState::slash)] = TokenType::fslash;
+    return types;
+}();
+
+inline void error_invalid_token() {
+    std::cerr << "Invalid token" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+class Tokenizer {
+public:
+    Tokenizer(const std::string_view src, SymbolTable& symbols) : m_src(src), m_symbols(&symbols) {
+    }
+
+    // Lexes the token starting at the current position. Each byte the DFA
+    // looks at costs one character-class lookup, one DFA lookup and one branch
+    // on the action. Whitespace, comment bodies and identifier tails are
+    // skipped by the vectorized scan routines. Returns false once the input is
+    // exhausted or an invalid byte was hit; failed() tells the two apart. The
+    // tokenizer never reports errors itself, so it can run off the main thread.
+    bool next(Token& token) {
+        LexState state = LexState::start;
+        size_t begin = m_curr_idx;
+        while (m_curr_idx < m_src.size()) {
+            const CharClass cls = k_char_classes[static_cast<unsigned char>(m_src[m_curr_idx])];
+            const LexStep step = k_lex_dfa[static_cast<size_t>(state)][static_cast<size_t>(cls)];
+            switch (step.action) {
+                case LexAction::none:
+                    break;
+                case LexAction::begin:
+                    begin = m_curr_idx;
+                    [[fallthrough]];
+                case LexAction::skip:
+                    state = step.next;
+                    m_curr_idx = skip_run(state, m_curr_idx + 1);
+                    continue;
+                case LexAction::single:
+                    token = { k_single_char_tokens[static_cast<unsigned char>(m_src[m_curr_idx])], m_src.substr(m_curr_idx, 1) };
+                    m_curr_idx++;
+                    return true;
+                case LexAction::finish:
+                    token = make_token(state, begin);
+                    return true;
+                case LexAction::invalid:
+                    m_failed = true;
+                    m_curr_idx = m_src.size();
+                    return false;
             }
+            state = step.next;
+            m_curr_idx++;
+        }
+        switch (state) {
+            case LexState::ident:
+            case LexState::int_lit:
+            case LexState::slash:
+                token = make_token(state, begin);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    TokenBuffer tokenize() {
+        if (m_src.size() > UINT32_MAX) {
+            std::cerr << "Source file too large" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        TokenBuffer tokens(m_src);
+        if (!tokenize_into(tokens)) {
+            error_invalid_token();
         }
         m_curr_idx = 0;
         return tokens;
     }
 
+    // Appends every remaining token to `tokens`. Their source may be larger
+    // than this tokenizer's, as long as it contains it; offsets are stored
+    // relative to the buffer's source. Returns false on an invalid token.
+    bool tokenize_into(TokenBuffer& tokens) {
+        Token token {};
+        while (next(token)) {
+            tokens.push_back(token);
+        }
+        return !m_failed;
+    }
+
+    [[nodiscard]] bool failed() const {
+        return m_failed;
+    }
+
 private:
-    [[nodiscard]] std::optional<char> peek(size_t offset = 0) const {
-        if (m_curr_idx + offset >= m_src.length()) {
-            return {};
+    // Skips the rest of the run that `state` is in, starting at `idx`.
+    [[nodiscard]] size_t skip_run(const LexState state, size_t idx) const {
+        switch (state) {
+            case LexState::start:
+                return k_scan_routines.skip_space(m_src, idx);
+            case LexState::ident:
+                return k_scan_routines.skip_alnum(m_src, idx);
+            case LexState::int_lit:
+                while (idx < m_src.size() && k_char_classes[static_cast<unsigned char>(m_src[idx])] == CharClass::digit) {
+                    idx++;
+                }
+                return idx;
+            case LexState::line_comment:
+                return k_scan_routines.find_line_end(m_src, idx);
+            case LexState::block_comment:
+                return k_scan_routines.find_block_comment_end(m_src, idx);
+            default:
+                return idx;
         }
-        return m_src.at(m_curr_idx + offset);
     }
 
-    char consume() {
-        return m_src.at(m_curr_idx++);
+    [[nodiscard]] Token make_token(const LexState state, const size_t begin) const {
+        const std::string_view text = m_src.substr(begin, m_curr_idx - begin);
+        if (state == LexState::ident) {
+            const TokenType type = classify_word(text);
+            return { type, text, type == TokenType::ident ? m_symbols->intern(text) : 0 };
+        }
+        return { k_state_tokens[static_cast<size_t>(state)], text };
     }
 
-    const std::string m_src;
+    const std::string_view m_src;
+    SymbolTable* m_symbols;
     size_t m_curr_idx = 0;
+    bool m_failed = false;
+};
+
+// Pulls tokens from `Source` only when the parser asks for them and keeps the
+// most recent ones in a small ring, so parsing starts before lexing is done
+// and token memory stays constant however large the input is. Offers the same
+// index-based interface as TokenBuffer, restricted to the window the parser
+// actually uses. `Source` is a Tokenizer, or anything else with the same
+// next()/failed() pair (see PipelinedTokenizer).
+template <typename Source>
+class TokenStream {
+public:
+    // The parser looks at most three tokens ahead (`let ident =` in
+    // parse_stmt), and diagnostics look one token back.
+    static constexpr size_t k_lookahead = 3;
+    static constexpr size_t k_capacity = k_lookahead + 1;
+
+    TokenStream(const std::string_view src, Source source)
+        : m_source(std::move(source))
+        , m_src(src)
+        , m_lines(src) {
+    }
+
+    [[nodiscard]] bool has(const size_t idx) {
+        while (m_count <= idx && !m_done) {
+            if (m_source.next(m_ring[m_count % k_capacity])) {
+                m_count++;
+            }
+            else if (m_source.failed()) {
+                error_invalid_token();
+            }
+            else {
+                m_done = true;
+            }
+        }
+        return idx < m_count;
+    }
+
+    [[nodiscard]] TokenType type(const size_t idx) const {
+        return at(idx).type;
+    }
+
+    // The reference stays valid until the window moves past `idx`.
+    [[nodiscard]] const Token& at(const size_t idx) const {
+        assert(idx < m_count && idx + k_capacity >= m_count);
+        return m_ring[idx % k_capacity];
+    }
+
+    [[nodiscard]] std::uint32_t offset(const size_t idx) const {
+        return static_cast<std::uint32_t>(at(idx).value.data() - m_src.data());
+    }
+
+    [[nodiscard]] int line(const size_t idx) const {
+        return m_lines.line_of(offset(idx));
+    }
+
+private:
+    Source m_source;
+    std::string_view m_src;
+    LineIndex m_lines;
+    std::array<Token, k_capacity> m_ring {};
+    size_t m_count = 0;
+    bool m_done = false;
 };
@@ -0,0 +1,170 @@
+// Renders docs/grammar.md from the tables in src/grammar.hpp, so the document
+// cannot drift from what the parser accepts.
+//
+// Usage: grammar_doc <path to grammar.md>          fails if the file differs
+//        grammar_doc --write <path to grammar.md>  rewrites the file
+//
+// Stmt, Scope and IfPred and the operator precedences come from the tables.
+// Prog, Expr and Term are parsed by hand, outside the tables, so they are
+// written out here.
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/grammar.hpp"
+
+std::string nonterminal_name(const NonTerminal nonterminal) {
+    switch (nonterminal) {
+        case NonTerminal::stmt:
+        case NonTerminal::stmts:
+            return "Stmt";
+        case NonTerminal::scope:
+            return "Scope";
+        case NonTerminal::if_pred:
+            return "IfPred";
+        case NonTerminal::expr:
+            return "Expr";
+    }
+    return "";
+}
+
+std::string_view spelling(const TokenType type) {
+    for (const TokenSpelling& spelling : k_token_spellings) {
+        if (spelling.type == type) {
+            return spelling.text;
+        }
+    }
+    return "";
+}
+
+bool is_word(const TokenType type) {
+    return type == TokenType::ident || type == TokenType::int_lit || is_keyword({ type, spelling(type) });
+}
+
+std::string render_terminal(const TokenType type) {
+    switch (type) {
+        case TokenType::ident:
+            return "\\text{ident}";
+        case TokenType::int_lit:
+            return "\\text{int\\_lit}";
+        case TokenType::eq:
+            return " = ";
+        case TokenType::open_curly:
+            return "\\{";
+        case TokenType::close_curly:
+            return "\\}";
+        default:
+            break;
+    }
+    const std::string text(spelling(type));
+    return is_word(type) ? "\\text{" + text + "}" : text;
+}
+
+std::string render_nonterminal(const NonTerminal nonterminal) {
+    const std::string name = "[\\text{" + nonterminal_name(nonterminal) + "}]";
+    return nonterminal == NonTerminal::stmts ? name + "^*" : name;
+}
+
+std::string render_rhs(const Production& production) {
+    std::string out;
+    bool after_word = false;
+    for (size_t pos = 0; pos < production.length; pos++) {
+        const GrammarSymbol symbol = production.rhs[pos];
+        if (!symbol.terminal) {
+            out += render_nonterminal(symbol.nonterminal);
+            after_word = false;
+            continue;
+        }
+        if (after_word && is_word(symbol.token)) {
+            out += "\\space";
+        }
+        out += render_terminal(symbol.token);
+        after_word = is_word(symbol.token);
+    }
+    return out;
+}
+
+// One `[Lhs] &\to ...` line, with a cases block if there is more than one
+// alternative.
+std::string render_rule(const std::string& lhs, const std::vector<std::string>& alternatives) {
+    std::string out = "    [\\text{" + lhs + "}] &\\to";
+    if (alternatives.size() == 1) {
+        return out + " " + alternatives[0] + " \\\\\n";
+    }
+    out += "\n    \\begin{cases}\n";
+    for (size_t idx = 0; idx < alternatives.size(); idx++) {
+        out += "        " + alternatives[idx] + (idx + 1 < alternatives.size() ? " \\\\\n" : "\n");
+    }
+    return out + "    \\end{cases} \\\\\n";
+}
+
+std::string render_doc() {
+    std::string out = "<!-- Generated from src/grammar.hpp by tests/grammar_doc.cpp. Do not edit. -->\n\n"
+                      "$$\n\\begin{align}\n";
+    out += render_rule("Prog", { render_nonterminal(NonTerminal::stmts) });
+    std::vector<NonTerminal> order;
+    for (const Production& production : k_productions) {
+        if (std::find(order.begin(), order.end(), production.lhs) == order.end()) {
+            order.push_back(production.lhs);
+        }
+    }
+    for (const NonTerminal lhs : order) {
+        std::vector<std::string> alternatives;
+        for (const Production& production : k_productions) {
+            if (production.lhs == lhs) {
+                alternatives.push_back(render_rhs(production));
+            }
+        }
+        if (derives_empty(lhs)) {
+            alternatives.emplace_back("\\epsilon");
+        }
+        out += render_rule(nonterminal_name(lhs), alternatives);
+    }
+    out += render_rule("Expr", { "[\\text{Term}]", "[\\text{BinExpr}]" });
+    std::vector<std::string> operators;
+    for (const BinaryOperator& op : k_binary_operators) {
+        operators.push_back("[\\text{Expr}] " + render_terminal(op.token) + " [\\text{Expr}] & \\text{prec} = "
+            + std::to_string(op.prec));
+    }
+    out += render_rule("BinExpr", operators);
+    out += render_rule("Term",
+        { render_terminal(TokenType::int_lit), render_terminal(TokenType::ident),
+            "(" + render_nonterminal(NonTerminal::expr) + ")" });
+    out += "\\end{align}\n$$\n\n"
+           "The parser does not read this file. `src/grammar.hpp` holds the Stmt, Scope\n"
+           "and IfPred rules as data, together with the lookahead each rule needs, and\n"
+           "the operator precedences; the parser's dispatch and precedence tables are\n"
+           "computed from them at compile time. Prog, Expr and Term are parsed by hand.\n"
+           "\n"
+           "After changing the grammar, regenerate this file with\n"
+           "`cmake --build <build dir> --target update_grammar_doc`. The `grammar_doc`\n"
+           "test fails while the two disagree.\n";
+    return out;
+}
+
+int main(const int argc, const char* argv[]) {
+    const bool write = argc == 3 && std::string_view(argv[1]) == "--write";
+    if (argc != 2 && !write) {
+        std::cerr << "Usage: grammar_doc [--write] <path to grammar.md>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const char* const path = argv[argc - 1];
+    const std::string doc = render_doc();
+    if (write) {
+        std::ofstream(path, std::ios::binary) << doc;
+        return EXIT_SUCCESS;
+    }
+    std::stringstream current;
+    current << std::ifstream(path, std::ios::binary).rdbuf();
+    if (current.str() != doc) {
+        std::cerr << path << " does not match src/grammar.hpp. Expected:\n\n" << doc << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,340 @@
+// Random-edit test for IncrementalDocument: applies a long run of random
+// edits to a generated program and, after each one, checks the document's
+// AST against a fresh parse of its source.
+//
+// Usage: incremental_test [edits] [seed]
+//
+// Every edit keeps the program well-formed (a syntax error would end the
+// process), so the edits are built from the text itself: whole statements are
+// inserted, replaced and removed at the boundaries of the statement lists,
+// and single characters of literals, identifiers and whitespace are changed.
+
+#include <iostream>
+#include <cctype>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../src/incremental.hpp"
+
+using Random = std::mt19937;
+
+size_t pick(Random& rng, const size_t count) {
+    return std::uniform_int_distribution<size_t>(0, count - 1)(rng);
+}
+
+bool is_word_char(const char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) != 0;
+}
+
+bool is_space(const char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+// Identifiers all start with `v`, so no edit after the first character can
+// turn one into a keyword.
+std::string gen_ident(Random& rng) {
+    std::string ident = "v";
+    for (size_t len = pick(rng, 3); len > 0; len--) {
+        ident += static_cast<char>('a' + pick(rng, 26));
+    }
+    return ident;
+}
+
+std::string gen_expr(Random& rng, const size_t depth) {
+    switch (depth == 0 ? pick(rng, 2) : pick(rng, 4)) {
+        case 0:
+            return std::to_string(pick(rng, 1000));
+        case 1:
+            return gen_ident(rng);
+        case 2:
+            return "(" + gen_expr(rng, depth - 1) + ")";
+        default: {
+            static constexpr std::string_view k_ops[] = { " + ", " - ", " * ", " / " };
+            return gen_expr(rng, depth - 1) + std::string(k_ops[pick(rng, 4)]) + gen_expr(rng, depth - 1);
+        }
+    }
+}
+
+std::string gen_stmt(Random& rng, size_t depth);
+
+std::string gen_scope(Random& rng, const size_t depth) {
+    std::string scope = "{\n";
+    for (size_t count = pick(rng, 4); count > 0; count--) {
+        scope += gen_stmt(rng, depth - 1) + "\n";
+    }
+    return scope + "}";
+}
+
+std::string gen_stmt(Random& rng, const size_t depth) {
+    switch (depth == 0 ? pick(rng, 3) : pick(rng, 5)) {
+        case 0:
+            return "let " + gen_ident(rng) + " = " + gen_expr(rng, 2) + ";";
+        case 1:
+            return gen_ident(rng) + " = " + gen_expr(rng, 2) + ";";
+        case 2:
+            return "exit(" + gen_expr(rng, 2) + ");";
+        case 3:
+            return gen_scope(rng, depth);
+        default: {
+            std::string stmt = "if (" + gen_expr(rng, 2) + ") " + gen_scope(rng, depth);
+            for (size_t count = pick(rng, 3); count > 0; count--) {
+                stmt += " elif (" + gen_expr(rng, 2) + ") " + gen_scope(rng, depth);
+            }
+            if (pick(rng, 2) == 0) {
+                stmt += " else " + gen_scope(rng, depth);
+            }
+            return stmt;
+        }
+    }
+}
+
+size_t skip_space(const std::string_view src, size_t pos) {
+    while (pos < src.size() && is_space(src[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+std::string_view word_at(const std::string_view src, const size_t pos) {
+    size_t end = pos;
+    while (end < src.size() && is_word_char(src[end])) {
+        end++;
+    }
+    return src.substr(pos, end - pos);
+}
+
+// Position right after the `)` or `}` that closes the bracket at `pos`.
+size_t skip_brackets(const std::string_view src, size_t pos) {
+    const char open = src[pos];
+    const char close = open == '(' ? ')' : '}';
+    size_t depth = 0;
+    do {
+        if (src[pos] == open) {
+            depth++;
+        }
+        else if (src[pos] == close) {
+            depth--;
+        }
+        pos++;
+    } while (depth > 0);
+    return pos;
+}
+
+struct StmtRange {
+    size_t begin;
+    size_t end;
+};
+
+// Where whole statements can be inserted, replaced or removed.
+struct StmtBoundaries {
+    std::vector<StmtRange> stmts;
+    // Statement starts, plus the end of every statement list.
+    std::vector<size_t> inserts;
+};
+
+// Reads the statement lists of a well-formed program, nested ones included.
+StmtBoundaries find_stmt_boundaries(const std::string_view src) {
+    StmtBoundaries boundaries;
+    std::vector<size_t> lists { 0 };
+    while (!lists.empty()) {
+        size_t pos = skip_space(src, lists.back());
+        lists.pop_back();
+        while (pos < src.size() && src[pos] != '}') {
+            const size_t begin = pos;
+            if (src[pos] == '{') {
+                lists.push_back(pos + 1);
+                pos = skip_brackets(src, pos);
+            }
+            else if (word_at(src, pos) == "if") {
+                do {
+                    if (word_at(src, pos) != "else") {
+                        pos = skip_brackets(src, src.find('(', pos));
+                    }
+                    pos = src.find('{', pos);
+                    lists.push_back(pos + 1);
+                    pos = skip_space(src, skip_brackets(src, pos));
+                } while (word_at(src, pos) == "elif" || word_at(src, pos) == "else");
+            }
+            else {
+                pos = src.find(';', pos) + 1;
+            }
+            boundaries.stmts.push_back({ begin, pos });
+            boundaries.inserts.push_back(begin);
+            pos = skip_space(src, pos);
+        }
+        boundaries.inserts.push_back(pos);
+    }
+    return boundaries;
+}
+
+std::optional<TextEdit> gen_stmt_edit(Random& rng, const std::string_view src) {
+    const StmtBoundaries boundaries = find_stmt_boundaries(src);
+    const size_t op = pick(rng, 3);
+    if (op == 0 || boundaries.stmts.empty()) {
+        return TextEdit { boundaries.inserts[pick(rng, boundaries.inserts.size())], 0, gen_stmt(rng, 2) + "\n" };
+    }
+    const StmtRange stmt = boundaries.stmts[pick(rng, boundaries.stmts.size())];
+    return TextEdit { stmt.begin, stmt.end - stmt.begin, op == 1 ? gen_stmt(rng, 2) : "" };
+}
+
+// A one-character edit that keeps every token boundary where it is: a digit
+// of a literal or a non-leading character of an identifier is changed,
+// inserted or removed, or whitespace next to other whitespace or punctuation
+// is added or removed.
+std::optional<TextEdit> gen_char_edit(Random& rng, const std::string_view src) {
+    if (src.empty()) {
+        return {};
+    }
+    const size_t pos = pick(rng, src.size());
+    if (is_space(src[pos])) {
+        const bool joins = pos > 0 && is_word_char(src[pos - 1]) && pos + 1 < src.size() && is_word_char(src[pos + 1]);
+        if (pick(rng, 2) == 0 && !joins) {
+            return TextEdit { pos, 1, "" };
+        }
+        return TextEdit { pos, 0, pick(rng, 2) == 0 ? " " : "\n" };
+    }
+    if (!is_word_char(src[pos])) {
+        return {};
+    }
+    size_t word = pos;
+    while (word > 0 && is_word_char(src[word - 1])) {
+        word--;
+    }
+    const std::string_view text = word_at(src, word);
+    std::string replacement(1, static_cast<char>('0' + pick(rng, 10)));
+    if (text[0] == 'v') {
+        if (pos == word) {
+            return {};
+        }
+        if (pick(rng, 2) == 0) {
+            replacement[0] = static_cast<char>('a' + pick(rng, 26));
+        }
+    }
+    else if (std::isdigit(static_cast<unsigned char>(text[0])) == 0) {
+        return {};
+    }
+    switch (pick(rng, 3)) {
+        case 0:
+            return TextEdit { pos, 1, replacement };
+        case 1:
+            return text.size() < 8 ? std::optional(TextEdit { pos + 1, 0, replacement }) : std::nullopt;
+        default:
+            return text.size() > 1 && pos != word ? std::optional(TextEdit { pos, 1, "" }) : std::nullopt;
+    }
+}
+
+// Whether two ASTs have the same shape, literals and identifier names. Node
+// indices and symbol ids may differ.
+bool same_tree(const Ast& lhs, const SymbolNames lhs_names, const Ast& rhs, const SymbolNames rhs_names) {
+    std::vector<std::pair<NodeIndex, NodeIndex>> tasks { { lhs.root(), rhs.root() } };
+    while (!tasks.empty()) {
+        const auto [l, r] = tasks.back();
+        tasks.pop_back();
+        if (l == k_no_node || r == k_no_node) {
+            if (l != r) {
+                return false;
+            }
+            continue;
+        }
+        const NodeKind kind = lhs.kind(l);
+        if (kind != rhs.kind(r)) {
+            return false;
+        }
+        const AstNode& ln = lhs.node(l);
+        const AstNode& rn = rhs.node(r);
+        switch (kind) {
+            case NodeKind::int_lit:
+                if (lhs.int_value(l) != rhs.int_value(r)) {
+                    return false;
+                }
+                break;
+            case NodeKind::ident:
+                if (lhs_names.name(ln.a) != rhs_names.name(rn.a)) {
+                    return false;
+                }
+                break;
+            case NodeKind::stmt_let:
+            case NodeKind::stmt_assign:
+                if (lhs_names.name(ln.a) != rhs_names.name(rn.a)) {
+                    return false;
+                }
+                tasks.emplace_back(ln.b, rn.b);
+                break;
+            case NodeKind::scope:
+            case NodeKind::prog: {
+                const ArenaSpan<NodeIndex> ls = lhs.stmts(l);
+                const ArenaSpan<NodeIndex> rs = rhs.stmts(r);
+                if (ls.size != rs.size) {
+                    return false;
+                }
+                for (size_t idx = 0; idx < ls.size; idx++) {
+                    tasks.emplace_back(ls[idx], rs[idx]);
+                }
+                break;
+            }
+            case NodeKind::stmt_exit:
+            case NodeKind::pred_else:
+                tasks.emplace_back(ln.a, rn.a);
+                break;
+            case NodeKind::stmt_if:
+            case NodeKind::pred_elif:
+                tasks.emplace_back(ln.c, rn.c);
+                [[fallthrough]];
+            default:
+                tasks.emplace_back(ln.a, rn.a);
+                tasks.emplace_back(ln.b, rn.b);
+                break;
+        }
+    }
+    return true;
+}
+
+bool matches_full_parse(IncrementalDocument& doc) {
+    SymbolTable symbols;
+    Tokenizer tokenizer(doc.source(), symbols);
+    Parser parser(tokenizer.tokenize());
+    const std::optional<Ast> full = parser.parse_prog();
+    return same_tree(doc.ast(), doc.names(), full.value(), symbols.names());
+}
+
+int main(const int argc, const char* argv[]) {
+    const size_t edit_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    const unsigned seed = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 1;
+    Random rng(seed);
+
+    std::string source;
+    for (size_t count = 0; count < 200; count++) {
+        source += gen_stmt(rng, 3) + "\n";
+    }
+    IncrementalDocument doc(source);
+    if (!matches_full_parse(doc)) {
+        std::cerr << "Initial parse differs from a full parse (seed " << seed << ")" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (size_t done = 0; done < edit_count;) {
+        const std::optional<TextEdit> edit
+            = pick(rng, 4) == 0 ? gen_stmt_edit(rng, doc.source()) : gen_char_edit(rng, doc.source());
+        if (!edit.has_value()) {
+            continue;
+        }
+        const std::string before = doc.source();
+        doc.apply(edit.value());
+        if (!matches_full_parse(doc)) {
+            std::cerr << "Edit " << done << " (seed " << seed << ") differs from a full parse: offset "
+                      << edit->offset << ", removed " << edit->removed << ", inserted \"" << edit->inserted
+                      << "\"\n--- before ---\n"
+                      << before << "\n--- after ---\n"
+                      << doc.source() << std::endl;
+            return EXIT_FAILURE;
+        }
+        done++;
+    }
+    std::cout << edit_count << " edits match a full parse" << std::endl;
+    return EXIT_SUCCESS;
+}